@@ -27,12 +27,15 @@
 #include <vector>
 #include <chrono>
 #include <unordered_map>
+#include <thread>
 
 #include <gdc/nanomap.hpp>
+#include <gdc/concurrent_nanomap.hpp>
 
 
 typedef std::unordered_map<int, int> um;
 typedef gdc::nanomap<int, int> nm;
+typedef gdc::nanomap<int, int, std::equal_to<int>, gdc::filtered_search<int>> fnm;
 
 
 void
@@ -50,8 +53,10 @@ run_um(um& needles, const std::vector<int>& haystack)
 }
 
 
+// For nanomaps with any search policy.
+template<typename map_type>
 void
-run_nm(nm& needles, const std::vector<int>& haystack)
+run_nm(map_type& needles, const std::vector<int>& haystack)
 {
 	for (auto hit = haystack.cbegin(); hit != haystack.cend(); ++hit)
 	{
@@ -65,6 +70,66 @@ run_nm(nm& needles, const std::vector<int>& haystack)
 }
 
 
+template<typename search>
+std::chrono::milliseconds
+time_skewed(const std::vector<int>& keys, const std::vector<int>& haystack)
+{
+	gdc::nanomap_factory<int, int, 64, std::equal_to<int>, search> factory;
+	auto& needles = factory.get();
+	
+	for (auto i : keys)
+	{
+		needles[i] = i;
+	}
+	
+	run_nm(needles, haystack);
+	run_nm(needles, haystack);
+	auto t0 = std::chrono::high_resolution_clock::now();
+	run_nm(needles, haystack);
+	auto t1 = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0);
+}
+
+
+void
+run_nm_batch(nm& needles, const std::vector<int>& haystack)
+{
+	std::vector<int> counts(needles.size());
+	needles.count_many(haystack.data(), haystack.data() + haystack.size(), counts.data());
+	
+	for (nm::size_type i = 0; i < needles.size(); ++i)
+	{
+		nm::iterator(&needles, i).value() += counts[i];
+	}
+}
+
+
+void
+run_nm_parallel(nm& needles, const std::vector<int>& haystack, std::size_t threads)
+{
+	// Each worker counts into its own vector, padded to keep the vectors
+	// off each other's cache lines.
+	std::vector<std::vector<int>> counts(threads, std::vector<int>(needles.size() + 16));
+	const nm::size_type missing = needles.max_size();
+	
+	gdc::parallel_find_each(needles, haystack.data(), haystack.data() + haystack.size(), [&counts, missing](std::size_t worker, std::size_t, nm::size_type i)
+	{
+		if (i != missing)
+		{
+			++counts[worker][i];
+		}
+	}, threads);
+	
+	for (auto& worker : counts)
+	{
+		for (nm::size_type i = 0; i < needles.size(); ++i)
+		{
+			nm::iterator(&needles, i).value() += worker[i];
+		}
+	}
+}
+
+
 int
 main(int argc, char** argv)
 {
@@ -79,11 +144,14 @@ main(int argc, char** argv)
 	um um_needles;
 	gdc::nanomap_factory<int, int, 16> factory;
 	nm& nm_needles = factory.get();
+	gdc::nanomap_factory<int, int, 16, std::equal_to<int>, gdc::filtered_search<int>> filtered_factory;
+	fnm& fnm_needles = filtered_factory.get();
 	
 	for (auto i : input)
 	{
 		um_needles[i] = i;
 		nm_needles[i] = i;
+		fnm_needles[i] = i;
 	}
 	
 	// Warmup
@@ -103,4 +171,43 @@ main(int argc, char** argv)
 	t1 = std::chrono::high_resolution_clock::now();
 	auto duration_nm = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0);
 	std::cout << "gdc::nanomap duration: " << duration_nm.count() << " ms" << std::endl;
+	
+	run_nm_batch(nm_needles, haystack);
+	run_nm_batch(nm_needles, haystack);
+	t0 = std::chrono::high_resolution_clock::now();
+	run_nm_batch(nm_needles, haystack);
+	t1 = std::chrono::high_resolution_clock::now();
+	auto duration_batch = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0);
+	std::cout << "gdc::nanomap count_many duration: " << duration_batch.count() << " ms" << std::endl;
+	
+	const std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	run_nm_parallel(nm_needles, haystack, threads);
+	run_nm_parallel(nm_needles, haystack, threads);
+	t0 = std::chrono::high_resolution_clock::now();
+	run_nm_parallel(nm_needles, haystack, threads);
+	t1 = std::chrono::high_resolution_clock::now();
+	auto duration_parallel = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0);
+	std::cout << "gdc::nanomap parallel_find_each duration (" << threads << " threads): " << duration_parallel.count() << " ms" << std::endl;
+	
+	run_nm(fnm_needles, haystack);
+	run_nm(fnm_needles, haystack);
+	t0 = std::chrono::high_resolution_clock::now();
+	run_nm(fnm_needles, haystack);
+	t1 = std::chrono::high_resolution_clock::now();
+	auto duration_fnm = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0);
+	std::cout << "gdc::nanomap filtered_search duration: " << duration_fnm.count() << " ms" << std::endl;
+	
+	// Skewed lookups: every lookup hits, and 90% of them hit the 4 keys that
+	// were inserted last.
+	std::vector<int> keys(64);
+	std::generate(keys.begin(), keys.end(), []() { return std::rand(); });
+	
+	for (auto& i : haystack)
+	{
+		i = keys[std::rand() % 10 == 0 ? std::rand() % 60 : 60 + std::rand() % 4];
+	}
+	
+	std::cout << "skewed linear_search duration: " << time_skewed<gdc::linear_search<int>>(keys, haystack).count() << " ms" << std::endl;
+	std::cout << "skewed transpose_search duration: " << time_skewed<gdc::transpose_search<int>>(keys, haystack).count() << " ms" << std::endl;
+	std::cout << "skewed move_to_front_search duration: " << time_skewed<gdc::move_to_front_search<int>>(keys, haystack).count() << " ms" << std::endl;
 }
@@ -1,4 +1,5 @@
 TARGET := tests/demo
-TGT_CXXFLAGS += -O3
+TGT_CXXFLAGS += -O3 -pthread
+TGT_LDFLAGS := -pthread
 TGT_INCDIRS := ../include
 SOURCES := demo.cpp
@@ -0,0 +1,1342 @@
+//
+// Copyright (c) 2016 Dado Colussi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+#ifndef __gdc__concurrent_nanomap__
+#define __gdc__concurrent_nanomap__
+
+
+#include <gdc/nanomap.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace gdc
+{
+	
+	
+	namespace detail
+	{
+		
+		
+		// The size of a cache line, for keeping data written by different
+		// threads apart.
+		constexpr std::size_t cache_line = 64;
+		
+		
+		// The type returned by calling an lvalue of type function with an
+		// argument of type arg_type.
+		template<typename function, typename arg_type>
+		struct call_result
+		{
+			typedef decltype(std::declval<function&>()(std::declval<arg_type>())) type;
+		};
+		
+		
+		// A number that tells the calling thread apart from most others, for
+		// spreading threads over per-thread counters.
+		inline std::size_t thread_slot()
+		{
+			static std::atomic<std::size_t> next(0);
+			static thread_local std::size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+			return slot;
+		}
+		
+		
+		// An atomic that can be copied while no other thread uses it, so that
+		// nanomap can move it around while the map is being built.
+		template<typename value_type>
+		struct movable_atomic : std::atomic<value_type>
+		{
+			movable_atomic(value_type value = value_type()) : std::atomic<value_type>(value)
+			{
+			}
+			
+			
+			movable_atomic(const movable_atomic& a) : std::atomic<value_type>(a.load(std::memory_order_relaxed))
+			{
+			}
+			
+			
+			movable_atomic& operator=(const movable_atomic& a)
+			{
+				this->store(a.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				return *this;
+			}
+		};
+		
+		
+		template<typename value_type>
+		inline void plain_add(value_type* sum, const value_type* values, std::size_t size)
+		{
+			for (std::size_t i = 0; i < size; ++i)
+			{
+				sum[i] += values[i];
+			}
+		}
+		
+		
+#if defined(GDC_NANOMAP_SIMD)
+		
+		
+#define GDC_NANOMAP_TARGET(isa) __attribute__((target(isa)))
+		
+		
+		GDC_NANOMAP_TARGET("avx2") inline __m256i avx2_add(__m256i a, __m256i b, width_1)
+		{
+			return _mm256_add_epi8(a, b);
+		}
+		
+		
+		GDC_NANOMAP_TARGET("avx2") inline __m256i avx2_add(__m256i a, __m256i b, width_2)
+		{
+			return _mm256_add_epi16(a, b);
+		}
+		
+		
+		GDC_NANOMAP_TARGET("avx2") inline __m256i avx2_add(__m256i a, __m256i b, width_4)
+		{
+			return _mm256_add_epi32(a, b);
+		}
+		
+		
+		GDC_NANOMAP_TARGET("avx2") inline __m256i avx2_add(__m256i a, __m256i b, width_8)
+		{
+			return _mm256_add_epi64(a, b);
+		}
+		
+		
+		// Integers wrap around, like unsigned integers do.
+		template<typename value_type>
+		GDC_NANOMAP_TARGET("avx2") inline void avx2_add(value_type* sum, const value_type* values, std::size_t size)
+		{
+			constexpr std::size_t lanes = 32 / sizeof(value_type);
+			std::size_t i = 0;
+			
+			for (; i + lanes <= size; i += lanes)
+			{
+				const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sum + i));
+				const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(sum + i), avx2_add(a, b, std::integral_constant<std::size_t, sizeof(value_type)>()));
+			}
+			
+			for (; i < size; ++i)
+			{
+				typedef typename word<sizeof(value_type)>::type unsigned_type;
+				sum[i] = static_cast<value_type>(static_cast<unsigned_type>(sum[i]) + static_cast<unsigned_type>(values[i]));
+			}
+		}
+		
+		
+		GDC_NANOMAP_TARGET("avx2") inline void avx2_add(float* sum, const float* values, std::size_t size)
+		{
+			std::size_t i = 0;
+			
+			for (; i + 8 <= size; i += 8)
+			{
+				_mm256_storeu_ps(sum + i, _mm256_add_ps(_mm256_loadu_ps(sum + i), _mm256_loadu_ps(values + i)));
+			}
+			
+			plain_add(sum + i, values + i, size - i);
+		}
+		
+		
+		GDC_NANOMAP_TARGET("avx2") inline void avx2_add(double* sum, const double* values, std::size_t size)
+		{
+			std::size_t i = 0;
+			
+			for (; i + 4 <= size; i += 4)
+			{
+				_mm256_storeu_pd(sum + i, _mm256_add_pd(_mm256_loadu_pd(sum + i), _mm256_loadu_pd(values + i)));
+			}
+			
+			plain_add(sum + i, values + i, size - i);
+		}
+		
+		
+#undef GDC_NANOMAP_TARGET
+		
+		
+		template<typename value_type>
+		struct is_simd_addend : std::integral_constant<bool,
+			(std::is_integral<value_type>::value && !std::is_same<value_type, bool>::value) ||
+			std::is_same<value_type, float>::value || std::is_same<value_type, double>::value>
+		{
+		};
+		
+		
+		template<typename value_type>
+		inline void add(value_type* sum, const value_type* values, std::size_t size, std::true_type)
+		{
+			static const bool avx2 = detect_isa() >= isa::avx2;
+			
+			if (avx2)
+			{
+				avx2_add(sum, values, size);
+			}
+			else
+			{
+				plain_add(sum, values, size);
+			}
+		}
+		
+		
+		template<typename value_type>
+		inline void add(value_type* sum, const value_type* values, std::size_t size, std::false_type)
+		{
+			plain_add(sum, values, size);
+		}
+		
+		
+#endif
+		
+		
+		// Adds values[i] to sum[i] for each i in [0, size), using AVX2
+		// instructions for arithmetic types if the CPU supports them.
+		template<typename value_type>
+		inline void add(value_type* sum, const value_type* values, std::size_t size)
+		{
+#if defined(GDC_NANOMAP_SIMD)
+			add(sum, values, size, is_simd_addend<value_type>());
+#else
+			plain_add(sum, values, size);
+#endif
+		}
+		
+		
+	}
+	
+	
+	// A nanomap shared by one writer thread and any number of reader threads.
+	// Every change is made between two increments of a sequence counter.
+	// Readers do not lock: they read the map, and start over if the counter
+	// was odd or changed meanwhile, so reads scale with the number of cores
+	// as long as writes are rare. Because a reader may see a map in the middle
+	// of a change before discarding what it read, keys and values must be
+	// trivially copyable, and the search policy must support concurrent
+	// lookups and must not allocate; linear_search, filtered_search,
+	// tagged_search, hashed_search and sorted_search qualify. Writes must not
+	// be made from more than one thread at a time.
+	//
+	// Readers read the keys and values as plain memory while the writer may
+	// be changing them. This is a data race in the C++ memory model, which
+	// ThreadSanitizer reports, although a reader discards whatever it read
+	// during a change. It is what every seqlock over non-atomic data does.
+	template<typename key_type, typename mapped_type, std::size_t _capacity, typename key_equal = std::equal_to<key_type>, typename search = linear_search<key_type, key_equal>, typename _size_type = std::uint16_t>
+	class seqlock_nanomap
+	{
+	public:
+		
+		typedef nanomap_factory<key_type, mapped_type, _capacity, key_equal, search, _size_type> factory_type;
+		typedef typename factory_type::map_type map_type;
+		typedef typename map_type::size_type size_type;
+		
+		
+		static_assert(std::is_trivially_copyable<key_type>::value, "seqlock_nanomap needs trivially copyable keys");
+		static_assert(std::is_trivially_copyable<mapped_type>::value, "seqlock_nanomap needs trivially copyable values");
+		static_assert(search::concurrent_find, "seqlock_nanomap needs a search policy whose find() only reads the map");
+		static_assert(!search::allocates, "seqlock_nanomap needs a search policy that does not allocate");
+		
+		
+		seqlock_nanomap() : _sequence(0)
+		{
+		}
+		
+		
+		seqlock_nanomap(const seqlock_nanomap&) = delete;
+		seqlock_nanomap& operator=(const seqlock_nanomap&) = delete;
+		
+		
+		// Invokes fn(map) and returns its result, invoking fn again until it
+		// has seen the map in a consistent state. fn may see a map that is
+		// being changed, so it must only read the map, and the result must
+		// not refer to the map.
+		template<typename function>
+		typename std::decay<typename detail::call_result<function, const map_type&>::type>::type read(function fn) const
+		{
+			for (;;)
+			{
+				const std::uint32_t before = _sequence.load(std::memory_order_acquire);
+				
+				if ((before & 1) != 0)
+				{
+					continue;
+				}
+				
+				typename std::decay<typename detail::call_result<function, const map_type&>::type>::type result(fn(_factory.get()));
+				std::atomic_thread_fence(std::memory_order_acquire);
+				
+				if (_sequence.load(std::memory_order_relaxed) == before)
+				{
+					return result;
+				}
+			}
+		}
+		
+		
+		// Copies the value of key to value. Returns false if key is not found,
+		// and leaves value as it was.
+		bool find(const key_type& key, mapped_type& value) const
+		{
+			typename std::aligned_storage<sizeof(mapped_type), alignof(mapped_type)>::type copy;
+			
+			const bool found = read([&key, &copy](const map_type& map)
+			{
+				auto it = map.find(key);
+				
+				if (it == map.end())
+				{
+					return false;
+				}
+				
+				std::memcpy(&copy, &it.value(), sizeof(mapped_type));
+				return true;
+			});
+			
+			if (found)
+			{
+				std::memcpy(&value, &copy, sizeof(mapped_type));
+			}
+			
+			return found;
+		}
+		
+		
+		bool contains(const key_type& key) const
+		{
+			return read([&key](const map_type& map) { return map.find(key) != map.end(); });
+		}
+		
+		
+		size_type size() const
+		{
+			return read([](const map_type& map) { return map.size(); });
+		}
+		
+		
+		// Invokes fn(map) while readers are held off, and returns its result.
+		// For the writer thread only.
+		template<typename function>
+		typename detail::call_result<function, map_type&>::type write(function fn)
+		{
+			const writing guard(_sequence);
+			return fn(_factory.get());
+		}
+		
+		
+		// Inserts key or replaces its value. Throws std::overflow_error if
+		// the map is full.
+		void assign(const key_type& key, const mapped_type& value)
+		{
+			write([&](map_type& map) { map[key] = value; });
+		}
+		
+		
+		// Inserts key unless it is already in the map. Returns false if it
+		// is, or if the map is full.
+		bool insert(const key_type& key, const mapped_type& value)
+		{
+			return write([&](map_type& map) { return map.find(key) == map.end() && map.emplace(key, value).second; });
+		}
+		
+		
+		// Returns false if key is not found.
+		bool erase(const key_type& key)
+		{
+			return write([&key](map_type& map)
+			{
+				auto it = map.find(key);
+				
+				if (it == map.end())
+				{
+					return false;
+				}
+				
+				map.erase(it);
+				return true;
+			});
+		}
+		
+		
+		void clear()
+		{
+			write([](map_type& map) { map.clear(); });
+		}
+		
+		
+		// The map itself, for the writer thread only.
+		const map_type& unsafe_get() const
+		{
+			return _factory.get();
+		}
+		
+		
+	private:
+		
+		// Makes the sequence odd while alive, even if the change throws.
+		class writing
+		{
+		public:
+			
+			explicit writing(std::atomic<std::uint32_t>& sequence) : _sequence(sequence)
+			{
+				_sequence.store(_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+			}
+			
+			
+			~writing()
+			{
+				_sequence.store(_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+			}
+			
+			
+		private:
+			
+			std::atomic<std::uint32_t>& _sequence;
+			
+			
+		};
+		
+		
+		alignas(detail::cache_line) std::atomic<std::uint32_t> _sequence;
+		alignas(detail::cache_line) factory_type _factory;
+		
+		
+	};
+	
+	
+	// A nanomap for maps that are read far more often than they change,
+	// kept in several buffers. A writer copies the current map into a spare
+	// buffer, changes the copy and publishes it with a single store. Readers
+	// hold a snapshot of the map that was current when they took it, and
+	// never wait for writers; a buffer is reused only after its last reader
+	// has released it. Each thread marks the buffers it reads in a counter
+	// of its own, on a cache line of its own, so readers on different cores
+	// do not contend. Writers are serialized by a mutex.
+	//
+	// Snapshots are meant to be short-lived. A writer needs a buffer that is
+	// neither current nor being read, and waits until there is one. With two
+	// buffers, a snapshot held across an update() makes it wait until the
+	// snapshot is released; more buffers let writes proceed while older
+	// snapshots are still being read.
+	template<typename key_type, typename mapped_type, std::size_t _capacity, std::size_t buffers = 2, typename key_equal = std::equal_to<key_type>, typename search = linear_search<key_type, key_equal>, typename _size_type = std::uint16_t>
+	class snapshot_nanomap
+	{
+	public:
+		
+		typedef nanomap_factory<key_type, mapped_type, _capacity, key_equal, search, _size_type> factory_type;
+		typedef typename factory_type::map_type map_type;
+		typedef typename map_type::size_type size_type;
+		
+		
+		static_assert(buffers >= 2, "snapshot_nanomap needs at least two buffers");
+		static_assert(search::concurrent_find, "snapshot_nanomap needs a search policy whose find() only reads the map");
+		
+		
+		// A read-only view of the map as it was when the snapshot was taken.
+		class snapshot
+		{
+		public:
+			
+			snapshot(const snapshot&) = delete;
+			snapshot& operator=(const snapshot&) = delete;
+			
+			
+			snapshot(snapshot&& s) : _map(s._map), _readers(s._readers)
+			{
+				s._readers = nullptr;
+			}
+			
+			
+			~snapshot()
+			{
+				if (_readers != nullptr)
+				{
+					_readers->fetch_sub(1, std::memory_order_release);
+				}
+			}
+			
+			
+			const map_type& operator*() const
+			{
+				return *_map;
+			}
+			
+			
+			const map_type* operator->() const
+			{
+				return _map;
+			}
+			
+			
+		private:
+			
+			friend snapshot_nanomap;
+			
+			
+			const map_type* _map;
+			std::atomic<std::uint32_t>* _readers;
+			
+			
+			snapshot(const map_type* map, std::atomic<std::uint32_t>* readers) : _map(map), _readers(readers)
+			{
+			}
+			
+			
+		};
+		
+		
+		snapshot_nanomap() : _current(0)
+		{
+		}
+		
+		
+		snapshot_nanomap(const snapshot_nanomap&) = delete;
+		snapshot_nanomap& operator=(const snapshot_nanomap&) = delete;
+		
+		
+		// Takes a snapshot of the current map. The buffer holding it is not
+		// reused while the snapshot is alive.
+		snapshot read() const
+		{
+			reader& r = _readers[detail::thread_slot() % reader_slots];
+			
+			for (;;)
+			{
+				const std::size_t i = _current.load(std::memory_order_acquire);
+				r.reading[i].fetch_add(1);
+				
+				// A writer may have published another buffer and started
+				// reusing this one before it was marked as being read.
+				if (_current.load() == i)
+				{
+					return snapshot(&_buffers[i].get(), &r.reading[i]);
+				}
+				
+				r.reading[i].fetch_sub(1, std::memory_order_release);
+			}
+		}
+		
+		
+		// Copies the current map, invokes fn(copy) and publishes the copy.
+		// Returns the result of fn. If fn throws, nothing is published.
+		template<typename function>
+		typename detail::call_result<function, map_type&>::type update(function fn)
+		{
+			std::lock_guard<std::mutex> lock(_writer);
+			const std::size_t current = _current.load(std::memory_order_relaxed);
+			const std::size_t next = _spare(current);
+			map_type& map = _buffers[next].get();
+			const map_type& source = _buffers[current].get();
+			map.clear();
+			
+			for (auto it = source.cbegin(); it != source.cend(); ++it)
+			{
+				map.emplace(it.key(), it.value());
+			}
+			
+			return _apply(fn, map, next, std::is_void<typename detail::call_result<function, map_type&>::type>());
+		}
+		
+		
+	private:
+		
+		// The number of per-thread reader counters. Threads beyond this
+		// share counters.
+		static constexpr std::size_t reader_slots = 32;
+		
+		
+		// The number of snapshots of each buffer taken by the threads that
+		// use this counter.
+		struct reader
+		{
+			alignas(detail::cache_line) std::atomic<std::uint32_t> reading[buffers];
+			
+			
+			reader()
+			{
+				for (std::size_t i = 0; i < buffers; ++i)
+				{
+					reading[i].store(0, std::memory_order_relaxed);
+				}
+			}
+		};
+		
+		
+		alignas(detail::cache_line) std::atomic<std::size_t> _current;
+		std::mutex _writer;
+		factory_type _buffers[buffers];
+		mutable reader _readers[reader_slots];
+		
+		
+		bool _is_read(std::size_t i) const
+		{
+			for (std::size_t r = 0; r < reader_slots; ++r)
+			{
+				if (_readers[r].reading[i].load() != 0)
+				{
+					return true;
+				}
+			}
+			
+			return false;
+		}
+		
+		
+		// Waits for a buffer other than current that has no readers, backing
+		// off from yielding to sleeping while snapshots are held.
+		std::size_t _spare(std::size_t current) const
+		{
+			for (unsigned attempt = 0; ; ++attempt)
+			{
+				for (std::size_t i = 1; i < buffers; ++i)
+				{
+					const std::size_t j = (current + i) % buffers;
+					
+					if (!_is_read(j))
+					{
+						return j;
+					}
+				}
+				
+				if (attempt < 64)
+				{
+					std::this_thread::yield();
+				}
+				else
+				{
+					const unsigned shift = std::min(attempt - 64, 10u);
+					std::this_thread::sleep_for(std::chrono::microseconds(1u << shift));
+				}
+			}
+		}
+		
+		
+		// Publishes the buffer only if fn returns.
+		template<typename function>
+		void _apply(function& fn, map_type& map, std::size_t next, std::true_type)
+		{
+			fn(map);
+			_current.store(next);
+		}
+		
+		
+		template<typename function>
+		typename detail::call_result<function, map_type&>::type _apply(function& fn, map_type& map, std::size_t next, std::false_type)
+		{
+			typename detail::call_result<function, map_type&>::type result(fn(map));
+			_current.store(next);
+			return result;
+		}
+		
+		
+	};
+	
+	
+	// A map that only grows, for interning and first-seen tracking, into
+	// which any number of threads insert and look up keys. Like nanomap, it
+	// appends each item after the last one: an insert checks the slots taken
+	// so far for its key, claims the next slot only if no other thread has
+	// claimed one meanwhile, constructs the item in place and then publishes
+	// it by setting the slot's state. Hence no two slots hold the same key,
+	// and the map holds up to _capacity distinct keys. If constructing an
+	// item throws, its slot is left empty and not reused.
+	//
+	// find() never waits; it only sees published items. Inserts are not
+	// lock-free: an insert waits for the items in the slots claimed before
+	// it to be published, so an inserting thread that is descheduled
+	// between claiming and publishing its slot stalls the other inserters.
+	// Items cannot be erased or changed.
+	template<typename key_type, typename mapped_type, std::size_t _capacity, typename key_equal = std::equal_to<key_type>>
+	class append_only_nanomap
+	{
+	public:
+		
+		typedef std::size_t size_type;
+		
+		
+		append_only_nanomap() : _claimed(0), _size(0)
+		{
+			for (size_type i = 0; i < _capacity; ++i)
+			{
+				_state[i].store(pending, std::memory_order_relaxed);
+			}
+		}
+		
+		
+		append_only_nanomap(const append_only_nanomap&) = delete;
+		append_only_nanomap& operator=(const append_only_nanomap&) = delete;
+		
+		
+		// Not thread safe.
+		~append_only_nanomap()
+		{
+			for (size_type i = 0; i < _claimed_slots(); ++i)
+			{
+				if (_state[i].load(std::memory_order_relaxed) == live)
+				{
+					_key(i).~key_type();
+					_value(i).~mapped_type();
+				}
+			}
+		}
+		
+		
+		// The number of published items.
+		size_type size() const
+		{
+			return _size.load(std::memory_order_acquire);
+		}
+		
+		
+		constexpr size_type capacity() const
+		{
+			return _capacity;
+		}
+		
+		
+		// Returns the value of key, or nullptr if not found.
+		const mapped_type* find(const key_type& key) const
+		{
+			const size_type i = _find(key, 0, _claimed_slots());
+			return i < _capacity ? &_value(i) : nullptr;
+		}
+		
+		
+		bool contains(const key_type& key) const
+		{
+			return find(key) != nullptr;
+		}
+		
+		
+		// Returns the value of key, and whether it was inserted. If key was
+		// already in the map, the value is not constructed. If the map is
+		// full, returns { nullptr, false }.
+		template<typename ... Args>
+		std::pair<const mapped_type*, bool> emplace(const key_type& key, Args&& ... value_args)
+		{
+			// The slots below i have been checked for key. Slot i is claimed
+			// only if no other thread has claimed it meanwhile; otherwise the
+			// slots claimed since are checked, too.
+			size_type i = 0;
+			
+			for (;;)
+			{
+				size_type claimed = _claimed.load(std::memory_order_acquire);
+				const size_type found = _wait_find(key, i, claimed);
+				
+				if (found < claimed)
+				{
+					return std::pair<const mapped_type*, bool>(&_value(found), false);
+				}
+				
+				i = claimed;
+				
+				if (i >= _capacity)
+				{
+					return std::pair<const mapped_type*, bool>(nullptr, false);
+				}
+				
+				if (_claimed.compare_exchange_weak(claimed, i + 1, std::memory_order_acq_rel))
+				{
+					break;
+				}
+			}
+			
+			_construct(i, key, std::forward<Args>(value_args) ...);
+			_state[i].store(live, std::memory_order_release);
+			_size.fetch_add(1, std::memory_order_release);
+			return std::pair<const mapped_type*, bool>(&_value(i), true);
+		}
+		
+		
+		std::pair<const mapped_type*, bool> insert(const key_type& key, const mapped_type& value)
+		{
+			return emplace(key, value);
+		}
+		
+		
+		// Invokes fn(key, value) for each published item, in insertion order.
+		template<typename function>
+		void for_each(function fn) const
+		{
+			const size_type n = _claimed_slots();
+			
+			for (size_type i = 0; i < n; ++i)
+			{
+				if (_state[i].load(std::memory_order_acquire) == live)
+				{
+					fn(_key(i), _value(i));
+				}
+			}
+		}
+		
+		
+	private:
+		
+		// A slot is empty if constructing its item threw.
+		enum : std::uint8_t
+		{
+			pending, live, empty
+		};
+		
+		
+		alignas(detail::cache_line) std::atomic<size_type> _claimed;
+		alignas(detail::cache_line) std::atomic<size_type> _size;
+		std::atomic<std::uint8_t> _state[_capacity];
+		typename std::aligned_storage<sizeof(key_type), alignof(key_type)>::type _keys[_capacity];
+		typename std::aligned_storage<sizeof(mapped_type), alignof(mapped_type)>::type _values[_capacity];
+		
+		
+		size_type _claimed_slots() const
+		{
+			return _claimed.load(std::memory_order_acquire);
+		}
+		
+		
+		const key_type& _key(size_type i) const
+		{
+			return *reinterpret_cast<const key_type*>(&_keys[i]);
+		}
+		
+		
+		const mapped_type& _value(size_type i) const
+		{
+			return *reinterpret_cast<const mapped_type*>(&_values[i]);
+		}
+		
+		
+		key_type& _key(size_type i)
+		{
+			return *reinterpret_cast<key_type*>(&_keys[i]);
+		}
+		
+		
+		mapped_type& _value(size_type i)
+		{
+			return *reinterpret_cast<mapped_type*>(&_values[i]);
+		}
+		
+		
+		// Constructs the item in the claimed slot i. If that throws, the slot
+		// is marked empty, so that other threads stop waiting for it.
+		template<typename ... Args>
+		void _construct(size_type i, const key_type& key, Args&& ... value_args)
+		{
+			try
+			{
+				new (&_keys[i]) key_type(key);
+			}
+			catch (...)
+			{
+				_state[i].store(empty, std::memory_order_release);
+				throw;
+			}
+			
+			try
+			{
+				new (&_values[i]) mapped_type(std::forward<Args>(value_args) ...);
+			}
+			catch (...)
+			{
+				_key(i).~key_type();
+				_state[i].store(empty, std::memory_order_release);
+				throw;
+			}
+		}
+		
+		
+		// Returns the first live slot in [first, last) holding key, or
+		// _capacity if not found. Slots not yet published are skipped.
+		size_type _find(const key_type& key, size_type first, size_type last) const
+		{
+			key_equal eq;
+			
+			for (size_type i = first; i < last; ++i)
+			{
+				if (_state[i].load(std::memory_order_acquire) == live && eq(_key(i), key))
+				{
+					return i;
+				}
+			}
+			
+			return _capacity;
+		}
+		
+		
+		// Like _find(), but waits for each slot to be published, and returns
+		// last if not found.
+		size_type _wait_find(const key_type& key, size_type first, size_type last) const
+		{
+			key_equal eq;
+			
+			for (size_type i = first; i < last; ++i)
+			{
+				std::uint8_t state;
+				
+				while ((state = _state[i].load(std::memory_order_acquire)) == pending)
+				{
+					std::this_thread::yield();
+				}
+				
+				if (state == live && eq(_key(i), key))
+				{
+					return i;
+				}
+			}
+			
+			return last;
+		}
+		
+		
+	};
+	
+	
+	// Counters that several threads update without sharing cache lines. Each
+	// thread updates the values of its own shard, a nanomap holding the same
+	// keys in the same order as every other shard. Because the key order is
+	// the same, reduce() sums the shards by adding their value arrays element
+	// by element, with SIMD instructions and no key lookups. Threads must
+	// only change the values of their shards. Self-organizing search
+	// policies, which reorder a shard's keys on lookup, are rejected.
+	template<typename key_type, typename mapped_type, std::size_t _capacity, typename key_equal = std::equal_to<key_type>, typename search = linear_search<key_type, key_equal>, typename _size_type = std::uint16_t>
+	class sharded_nanomap
+	{
+	public:
+		
+		typedef nanomap_factory<key_type, mapped_type, _capacity, key_equal, search, _size_type> factory_type;
+		typedef typename factory_type::map_type map_type;
+		typedef typename map_type::size_type size_type;
+		
+		
+		static_assert(!search::self_organizing, "sharded_nanomap needs a search policy that keeps the keys in the same order in every shard");
+		
+		
+		// Every shard gets the keys in [first, last), in that order, with
+		// value-initialized values. Throws std::overflow_error if there are
+		// more keys than _capacity.
+		template<typename input_iterator>
+		sharded_nanomap(std::size_t shards, input_iterator first, input_iterator last) : _shards(shards + 1)
+		{
+			for (; first != last; ++first)
+			{
+				for (padded_factory& s : _shards)
+				{
+					s.factory.get()[*first];
+				}
+			}
+		}
+		
+		
+		std::size_t shards() const
+		{
+			return _shards.size() - 1;
+		}
+		
+		
+		map_type& shard(std::size_t i)
+		{
+			return _shards[i + 1].factory.get();
+		}
+		
+		
+		// Returns a map holding the sum of the values of each key in all
+		// shards. Not to be called while the shards are updated.
+		const map_type& reduce()
+		{
+			map_type& sum = _shards[0].factory.get();
+			const size_type n = sum.size();
+			
+			if (n == 0)
+			{
+				return sum;
+			}
+			
+			mapped_type* total = &sum.begin().value();
+			std::fill(total, total + n, mapped_type());
+			
+			for (std::size_t i = 0; i < shards(); ++i)
+			{
+				detail::add(total, &shard(i).begin().value(), n);
+			}
+			
+			return sum;
+		}
+		
+		
+		// Resets the values of all shards.
+		void reset()
+		{
+			for (padded_factory& s : _shards)
+			{
+				map_type& map = s.factory.get();
+				
+				if (!map.empty())
+				{
+					std::fill(&map.begin().value(), &map.begin().value() + map.size(), mapped_type());
+				}
+			}
+		}
+		
+		
+	private:
+		
+		// The padding keeps the values of neighbouring shards on separate
+		// cache lines, whatever the alignment of the allocation.
+		struct padded_factory
+		{
+			char padding[detail::cache_line];
+			factory_type factory;
+		};
+		
+		
+		// The first shard holds the sums.
+		std::vector<padded_factory> _shards;
+		
+		
+	};
+	
+	
+	// A map with a fixed set of keys whose values are atomics, so that any
+	// number of threads can update the values of the keys without locking.
+	// The keys are given when the map is constructed. Since they never
+	// change, lookups need no synchronization. Neighbouring values share
+	// cache lines, so values that many threads update heavily may be better
+	// kept in a sharded_nanomap. Search policies whose find() writes to the
+	// map are rejected. The values of the map derive from
+	// std::atomic<value_type>.
+	template<typename key_type, typename value_type, std::size_t _capacity, typename key_equal = std::equal_to<key_type>, typename search = linear_search<key_type, key_equal>, typename _size_type = std::uint16_t>
+	class atomic_nanomap
+	{
+	public:
+		
+		typedef nanomap_factory<key_type, detail::movable_atomic<value_type>, _capacity, key_equal, search, _size_type> factory_type;
+		typedef typename factory_type::map_type map_type;
+		typedef typename map_type::size_type size_type;
+		
+		
+		static_assert(search::concurrent_find, "atomic_nanomap needs a search policy whose find() only reads the map");
+		
+		
+		// The map holds the keys in [first, last), each with the value
+		// initial. Throws std::overflow_error if there are more keys than
+		// _capacity.
+		template<typename input_iterator>
+		atomic_nanomap(input_iterator first, input_iterator last, value_type initial = value_type())
+		{
+			map_type& map = _factory.get();
+			
+			for (; first != last; ++first)
+			{
+				if (map.find(*first) == map.end())
+				{
+					if (map.size() >= map.max_size())
+					{
+						throw std::overflow_error("nanomap is full");
+					}
+					
+					map.emplace(*first, initial);
+				}
+			}
+		}
+		
+		
+		atomic_nanomap(const atomic_nanomap&) = delete;
+		atomic_nanomap& operator=(const atomic_nanomap&) = delete;
+		
+		
+		size_type size() const
+		{
+			return _factory.get().size();
+		}
+		
+		
+		// Returns the value of key, or nullptr if not found.
+		std::atomic<value_type>* find(const key_type& key)
+		{
+			auto it = _factory.get().find(key);
+			return it == _factory.get().end() ? nullptr : &it.value();
+		}
+		
+		
+		// Throws std::out_of_range if key is not found.
+		std::atomic<value_type>& at(const key_type& key)
+		{
+			return _factory.get().at(key);
+		}
+		
+		
+		value_type load(const key_type& key, std::memory_order order = std::memory_order_seq_cst)
+		{
+			return at(key).load(order);
+		}
+		
+		
+		void store(const key_type& key, value_type value, std::memory_order order = std::memory_order_seq_cst)
+		{
+			at(key).store(value, order);
+		}
+		
+		
+		// Adds delta to the value of key and returns the previous value.
+		// Throws std::out_of_range if key is not found.
+		value_type fetch_add(const key_type& key, value_type delta, std::memory_order order = std::memory_order_seq_cst)
+		{
+			return at(key).fetch_add(delta, order);
+		}
+		
+		
+		// Replaces the value of key with desired if it equals expected, and
+		// otherwise loads the value into expected. Returns true if the value
+		// was replaced. Throws std::out_of_range if key is not found.
+		bool compare_exchange(const key_type& key, value_type& expected, value_type desired, std::memory_order order = std::memory_order_seq_cst)
+		{
+			return at(key).compare_exchange_strong(expected, desired, order);
+		}
+		
+		
+		// The keys and values, for iterating over them.
+		const map_type& get() const
+		{
+			return _factory.get();
+		}
+		
+		
+	private:
+		
+		factory_type _factory;
+		
+		
+	};
+	
+	
+	// Many independent nanomaps shared by several threads, such as one map
+	// per session. The maps are guarded by a number of spinlocks, each on a
+	// cache line of its own, and map id is guarded by lock id % stripes.
+	// The maps are padded apart, so threads working on maps guarded by
+	// different locks do not contend, and with enough stripes the table
+	// scales with the number of cores.
+	template<typename key_type, typename mapped_type, std::size_t _capacity, typename key_equal = std::equal_to<key_type>, typename search = linear_search<key_type, key_equal>, typename _size_type = std::uint16_t>
+	class nanomap_table
+	{
+	public:
+		
+		typedef nanomap_factory<key_type, mapped_type, _capacity, key_equal, search, _size_type> factory_type;
+		typedef typename factory_type::map_type map_type;
+		
+		
+		nanomap_table(std::size_t maps, std::size_t stripes) : _factories(maps), _stripes(std::max<std::size_t>(stripes, 1))
+		{
+		}
+		
+		
+		nanomap_table(const nanomap_table&) = delete;
+		nanomap_table& operator=(const nanomap_table&) = delete;
+		
+		
+		std::size_t size() const
+		{
+			return _factories.size();
+		}
+		
+		
+		std::size_t stripes() const
+		{
+			return _stripes.size();
+		}
+		
+		
+		// Invokes fn(map) with map id locked, and returns the result of fn.
+		// fn must not lock another map, since it may share the lock.
+		template<typename function>
+		typename detail::call_result<function, map_type&>::type with_map(std::size_t id, function fn)
+		{
+			const locked guard(_stripes[id % _stripes.size()].lock);
+			return fn(_factories[id].factory.get());
+		}
+		
+		
+	private:
+		
+		// The padding keeps neighbouring maps, which may be guarded by
+		// different locks, off each other's cache lines.
+		struct padded_factory
+		{
+			char padding[detail::cache_line];
+			factory_type factory;
+		};
+		
+		
+		// The padding keeps each lock off the cache lines of its neighbours,
+		// whatever the alignment of the allocation.
+		struct stripe
+		{
+			char padding[detail::cache_line];
+			std::atomic<bool> lock;
+			
+			
+			stripe() : lock(false)
+			{
+			}
+		};
+		
+		
+		class locked
+		{
+		public:
+			
+			// Spins on a plain load, so that waiting threads do not take the
+			// cache line away from the thread holding the lock.
+			explicit locked(std::atomic<bool>& lock) : _lock(lock)
+			{
+				while (_lock.exchange(true, std::memory_order_acquire))
+				{
+					for (unsigned spins = 0; _lock.load(std::memory_order_relaxed); ++spins)
+					{
+						if (spins >= 64)
+						{
+							std::this_thread::yield();
+						}
+					}
+				}
+			}
+			
+			
+			~locked()
+			{
+				_lock.store(false, std::memory_order_release);
+			}
+			
+			
+		private:
+			
+			std::atomic<bool>& _lock;
+			
+			
+		};
+		
+		
+		std::vector<padded_factory> _factories;
+		std::vector<stripe> _stripes;
+		
+		
+	};
+	
+	
+	// Looks up every key in [first, last) on the given number of threads,
+	// the calling thread included, and invokes fn(worker, j, index) for each
+	// key first[j], where worker is in [0, threads) and index is the index
+	// of the key in map, or map.max_size() if not found. The keys are split
+	// into chunks that the workers claim one at a time, so workers that
+	// finish early take over the remaining work. Each chunk is looked up
+	// with find_many(). fn is invoked concurrently, with each worker's
+	// calls on one thread, so per-worker results can be kept without locks.
+	// fn must not throw, and the map must not change while it is searched,
+	// which rules out self-organizing search policies. Returns the number of
+	// keys found.
+	template<typename key_type, typename mapped_type, typename key_equal, typename search, typename size_type, typename function>
+	std::size_t parallel_find_each(const nanomap<key_type, mapped_type, key_equal, search, size_type>& map, const key_type* first, const key_type* last, function fn, std::size_t threads)
+	{
+		constexpr std::size_t chunk = 64 * detail::batch_size;
+		const std::size_t n = static_cast<std::size_t>(last - first);
+		std::atomic<std::size_t> next(0);
+		std::atomic<std::size_t> found(0);
+		
+		auto worker = [&](std::size_t w)
+		{
+			std::vector<size_type> indices(chunk);
+			std::size_t hits = 0;
+			
+			for (std::size_t begin; (begin = next.fetch_add(chunk, std::memory_order_relaxed)) < n; )
+			{
+				const std::size_t end = std::min(n, begin + chunk);
+				hits += map.find_many(first + begin, first + end, indices.data());
+				
+				for (std::size_t j = begin; j < end; ++j)
+				{
+					fn(w, j, indices[j - begin]);
+				}
+			}
+			
+			found.fetch_add(hits, std::memory_order_relaxed);
+		};
+		
+		// Joins the started threads on every path, so that an exception
+		// thrown by a thread start or by the calling thread's share of the
+		// work does not destroy joinable threads. On the exception path
+		// the remaining keys are skipped, so that the workers stop soon.
+		struct joined_threads
+		{
+			std::vector<std::thread> threads;
+			std::atomic<std::size_t>& next;
+			std::size_t n;
+			
+			
+			void join()
+			{
+				next.store(n, std::memory_order_relaxed);
+				
+				for (std::thread& t : threads)
+				{
+					t.join();
+				}
+				
+				threads.clear();
+			}
+			
+			
+			~joined_threads()
+			{
+				join();
+			}
+		};
+		
+		joined_threads workers{ std::vector<std::thread>(), next, n };
+		
+		for (std::size_t w = 1; w < threads && w * chunk < n; ++w)
+		{
+			workers.threads.emplace_back(worker, w);
+		}
+		
+		worker(0);
+		workers.join();
+		
+		return found.load();
+	}
+	
+	
+}
+
+
+#endif
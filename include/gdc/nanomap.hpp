@@ -26,6 +26,7 @@
 
 
 #include <type_traits>
+#include <algorithm>
 #include <stdexcept>
 #include <functional>
 #include <utility>
@@ -33,512 +34,3420 @@
 #include <tuple>
 #include <cstdlib>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+#if !defined(GDC_NANOMAP_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GDC_NANOMAP_SIMD 1
+#include <immintrin.h>
+#endif
 
 
 namespace gdc
 {
 	
 	
-	template<typename key_type, typename mapped_type, typename key_equal> class nanomap;
-	
-	
-	template<bool is_const, typename key_type, typename mapped_type, typename key_equal>
-	class nanomap_iterator
+	namespace detail
 	{
-	public:
 		
-		typedef nanomap<key_type, mapped_type, key_equal> map_type;
-		typedef typename map_type::reference reference;
-		typedef typename map_type::const_reference const_reference;
-		typedef typename map_type::size_type size_type;
-		typedef typename std::pair<const key_type&, reference> value_type;
-		typedef typename std::conditional<is_const, const_reference, reference>::type ref;
-		typedef nanomap_iterator<false, key_type, mapped_type, key_equal> iterator;
-		typedef nanomap_iterator<true, key_type, mapped_type, key_equal> const_iterator;
-		friend map_type;
-		friend const_iterator;
-		friend iterator;
+		
+		// True if keys can be compared bitwise, several keys at a time.
+		// Floating point keys are excluded because of NaN and -0.0.
+		template<typename key_type, typename key_equal>
+		struct is_simd_key : std::integral_constant<bool,
+			(std::is_integral<key_type>::value || std::is_enum<key_type>::value || std::is_pointer<key_type>::value) &&
+			!std::is_same<key_type, bool>::value &&
+			(sizeof(key_type) == 1 || sizeof(key_type) == 2 || sizeof(key_type) == 4 || sizeof(key_type) == 8) &&
+			std::is_same<key_equal, std::equal_to<key_type>>::value>
+		{
+		};
 		
 		
-		nanomap_iterator(map_type* map, size_type index) : _map(map), _index(index)
+		template<std::size_t width> struct word;
+		template<> struct word<1> { typedef std::uint8_t type; };
+		template<> struct word<2> { typedef std::uint16_t type; };
+		template<> struct word<4> { typedef std::uint32_t type; };
+		template<> struct word<8> { typedef std::uint64_t type; };
+		
+		
+		template<std::size_t width>
+		inline typename word<width>::type load_word(const void* p)
 		{
+			typename word<width>::type w;
+			std::memcpy(&w, p, width);
+			return w;
 		}
 		
 		
-		nanomap_iterator(const map_type* map, size_type index) : _map(const_cast<map_type*>(map)), _index(index)
+		// Scalar fallback for the slots that do not fill a whole vector.
+		template<std::size_t width>
+		inline std::size_t scalar_find(const void* keys, std::size_t first, std::size_t size, const void* key)
 		{
+			const unsigned char* p = static_cast<const unsigned char*>(keys);
+			const typename word<width>::type needle = load_word<width>(key);
+			
+			for (std::size_t i = first; i < size; ++i)
+			{
+				if (load_word<width>(p + i * width) == needle)
+				{
+					return i;
+				}
+			}
+			
+			return size;
 		}
 		
 		
-		// Note: this allows const_iterator(const iterator&).
-		template<typename IT = nanomap_iterator>
-		nanomap_iterator(const IT& it) : _map(const_cast<map_type*>(it._map)), _index(it._index)
+#if defined(GDC_NANOMAP_SIMD)
+		
+		
+		// The vectorized kernels are compiled for several instruction sets
+		// regardless of the compiler flags, and the best one supported by the
+		// CPU is picked at run time. See simd_find().
+#define GDC_NANOMAP_TARGET(isa) __attribute__((target(isa)))
+		
+		
+		typedef std::integral_constant<std::size_t, 1> width_1;
+		typedef std::integral_constant<std::size_t, 2> width_2;
+		typedef std::integral_constant<std::size_t, 4> width_4;
+		typedef std::integral_constant<std::size_t, 8> width_8;
+		
+		
+		inline unsigned ctz(unsigned mask)
 		{
-			static_assert(
-				std::is_same<IT, nanomap_iterator>::value ||
-				std::is_same<IT, iterator>::value, "Invalid iterator type");
+			return static_cast<unsigned>(__builtin_ctz(mask));
 		}
 		
 		
-		// Note: this allows const_iterator(const iterator&&).
-		template<typename IT = nanomap_iterator>
-		nanomap_iterator(IT&& it) : _map(it._map), _index(it._index)
+		inline unsigned ctz(unsigned long long mask)
 		{
-			if (it._map != nullptr)
-			{
-				it._index = it._map->max_size();
-			}
-			
-			it._map = nullptr;
+			return static_cast<unsigned>(__builtin_ctzll(mask));
 		}
 		
 		
-		nanomap_iterator() : nanomap_iterator(nullptr, 0)
+		GDC_NANOMAP_TARGET("sse2") inline __m128i sse2_broadcast(const void* key, width_1)
 		{
+			return _mm_set1_epi8(static_cast<char>(load_word<1>(key)));
 		}
 		
 		
-		~nanomap_iterator() = default;
+		GDC_NANOMAP_TARGET("sse2") inline __m128i sse2_broadcast(const void* key, width_2)
+		{
+			return _mm_set1_epi16(static_cast<short>(load_word<2>(key)));
+		}
 		
 		
-		template<typename IT = nanomap_iterator>
-		nanomap_iterator& operator=(const nanomap_iterator& it)
+		GDC_NANOMAP_TARGET("sse2") inline __m128i sse2_broadcast(const void* key, width_4)
 		{
-			static_assert(
-				std::is_same<IT, nanomap_iterator>::value ||
-				std::is_same<IT, iterator>::value, "Invalid type");
-			_map = it._map;
-			_index = it._index;
-			return *this;
+			return _mm_set1_epi32(static_cast<int>(load_word<4>(key)));
 		}
 		
 		
-		nanomap_iterator& operator=(nanomap_iterator&& it)
+		GDC_NANOMAP_TARGET("sse2") inline __m128i sse2_broadcast(const void* key, width_8)
 		{
-			_map = it._map;
-			_index = it._index;
-			
-			if (it._map != nullptr)
-			{
-				it._index = it._map->max_size();
-				it._map = nullptr;
-			}
-			
-			return *this;
+			return _mm_set1_epi64x(static_cast<long long>(load_word<8>(key)));
 		}
 		
 		
-		nanomap_iterator& operator++()
+		GDC_NANOMAP_TARGET("sse2") inline unsigned sse2_match(__m128i keys, __m128i needle, width_1)
 		{
-			if (++_index >= _map->size())
-			{
-				_index = _map->max_size();
-			}
-			
-			return *this;
+			return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(keys, needle)));
 		}
 		
 		
-		nanomap_iterator& operator++(int)
+		GDC_NANOMAP_TARGET("sse2") inline unsigned sse2_match(__m128i keys, __m128i needle, width_2)
 		{
-			nanomap_iterator tmp(*this);
-			operator++();
-			return tmp;
+			return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi16(keys, needle)));
 		}
 		
 		
-		bool operator==(const iterator& rhs) const
+		GDC_NANOMAP_TARGET("sse2") inline unsigned sse2_match(__m128i keys, __m128i needle, width_4)
 		{
-			return _map != nullptr && _map == rhs._map && _index == rhs._index;
+			return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi32(keys, needle)));
 		}
 		
 		
-		bool operator==(const const_iterator& rhs) const
+		// SSE2 has no 64-bit compare: a lane matches if both of its halves do.
+		GDC_NANOMAP_TARGET("sse2") inline unsigned sse2_match(__m128i keys, __m128i needle, width_8)
 		{
-			return _map != nullptr && _map == rhs._map && _index == rhs._index;
+			__m128i eq = _mm_cmpeq_epi32(keys, needle);
+			eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+			return static_cast<unsigned>(_mm_movemask_epi8(eq));
 		}
 		
 		
-		bool operator!=(const iterator& rhs) const
+		GDC_NANOMAP_TARGET("avx2") inline __m256i avx2_broadcast(const void* key, width_1)
 		{
-			return _map == nullptr || rhs._map == nullptr || _map != rhs._map || _index != rhs._index;
+			return _mm256_set1_epi8(static_cast<char>(load_word<1>(key)));
 		}
 		
 		
-		bool operator!=(const const_iterator& rhs) const
+		GDC_NANOMAP_TARGET("avx2") inline __m256i avx2_broadcast(const void* key, width_2)
 		{
-			return _map == nullptr || rhs._map == nullptr || _map != rhs._map || _index != rhs._index;
+			return _mm256_set1_epi16(static_cast<short>(load_word<2>(key)));
 		}
 		
 		
-		value_type operator*()
+		GDC_NANOMAP_TARGET("avx2") inline __m256i avx2_broadcast(const void* key, width_4)
 		{
-			return value_type(_map->_keys[_index], _map->_values[_index]);
+			return _mm256_set1_epi32(static_cast<int>(load_word<4>(key)));
 		}
 		
 		
-		const key_type& key() const
+		GDC_NANOMAP_TARGET("avx2") inline __m256i avx2_broadcast(const void* key, width_8)
 		{
-			return _map->_keys[_index];
+			return _mm256_set1_epi64x(static_cast<long long>(load_word<8>(key)));
 		}
 		
 		
-		ref& value()
+		GDC_NANOMAP_TARGET("avx2") inline unsigned avx2_match(__m256i keys, __m256i needle, width_1)
 		{
-			return _map->_values[_index];
+			return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(keys, needle)));
 		}
 		
 		
-	private:
+		GDC_NANOMAP_TARGET("avx2") inline unsigned avx2_match(__m256i keys, __m256i needle, width_2)
+		{
+			return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(keys, needle)));
+		}
 		
-		map_type* _map;
-		size_type _index;
 		
-	};
-	
-	
-	template<typename key_type, typename mapped_type, typename key_equal = std::equal_to<key_type>>
-	class nanomap
-	{
-	public:
+		GDC_NANOMAP_TARGET("avx2") inline unsigned avx2_match(__m256i keys, __m256i needle, width_4)
+		{
+			return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi32(keys, needle)));
+		}
 		
-		typedef std::uint16_t size_type;
-		typedef mapped_type& reference;
-		typedef const mapped_type& const_reference;
-		typedef std::pair<const key_type, mapped_type> value_type;
-		typedef nanomap_iterator<false, key_type, mapped_type, key_equal> iterator;
-		typedef nanomap_iterator<true, key_type, mapped_type, key_equal> const_iterator;
-		friend iterator;
-		friend const_iterator;
 		
+		GDC_NANOMAP_TARGET("avx2") inline unsigned avx2_match(__m256i keys, __m256i needle, width_8)
+		{
+			return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi64(keys, needle)));
+		}
 		
-		nanomap() : _capacity(0), _size(0), _keys(nullptr), _values(nullptr)
+		
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline __m512i avx512_broadcast(const void* key, width_1)
 		{
+			return _mm512_set1_epi8(static_cast<char>(load_word<1>(key)));
 		}
 		
 		
-		nanomap(key_type* keys, mapped_type* values, size_type capacity, size_type size = 0) :
-			_capacity(capacity), _size(size), _keys(keys), _values(values)
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline __m512i avx512_broadcast(const void* key, width_2)
 		{
+			return _mm512_set1_epi16(static_cast<short>(load_word<2>(key)));
 		}
 		
 		
-		nanomap(const nanomap&) = delete;
-		nanomap(nanomap&&) = delete;
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline __m512i avx512_broadcast(const void* key, width_4)
+		{
+			return _mm512_set1_epi32(static_cast<int>(load_word<4>(key)));
+		}
 		
 		
-		~nanomap()
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline __m512i avx512_broadcast(const void* key, width_8)
 		{
-			clear();
+			return _mm512_set1_epi64(static_cast<long long>(load_word<8>(key)));
 		}
 		
 		
-		void init(key_type* keys, mapped_type* values, size_type capacity, size_type size = 0)
+		// The AVX-512 kernels load only the live lanes, so the key array is
+		// never read past size and no scalar epilogue is needed. The match
+		// masks have one bit per lane.
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline __m512i avx512_load(const void* keys, unsigned long long live, width_1)
 		{
-			_capacity = capacity;
-			_size = size;
-			_keys = keys;
-			_values = values;
+			return _mm512_maskz_loadu_epi8(live, keys);
 		}
 		
 		
-		bool empty() const
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline __m512i avx512_load(const void* keys, unsigned long long live, width_2)
 		{
-			return _size == 0;
+			return _mm512_maskz_loadu_epi16(static_cast<__mmask32>(live), keys);
 		}
 		
 		
-		size_type size() const
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline __m512i avx512_load(const void* keys, unsigned long long live, width_4)
 		{
-			return _size;
+			return _mm512_maskz_loadu_epi32(static_cast<__mmask16>(live), keys);
 		}
 		
 		
-		size_type max_size() const
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline __m512i avx512_load(const void* keys, unsigned long long live, width_8)
 		{
-			return _capacity;
+			return _mm512_maskz_loadu_epi64(static_cast<__mmask8>(live), keys);
 		}
 		
 		
-		void clear()
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline unsigned long long avx512_match(__m512i keys, __m512i needle, unsigned long long live, width_1)
 		{
-			for (size_type i = 0; i < _size; ++i)
-			{
-				_keys[i].~key_type();
-			}
-			
-			for (size_type i = 0; i < _size; ++i)
-			{
-				_values[i].~mapped_type();
-			}
-			
-			_size = 0;
+			return _mm512_mask_cmpeq_epi8_mask(live, keys, needle);
 		}
 		
 		
-		std::pair<iterator, bool> insert(const value_type& item)
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline unsigned long long avx512_match(__m512i keys, __m512i needle, unsigned long long live, width_2)
 		{
-			if (_size >= max_size())
-			{
-				return std::pair<iterator, bool>(end(), false);
-			}
-			
-			new (&_keys[_size]) key_type(item.first);
-			new (&_values[_size]) mapped_type(item.second);
-			return std::pair<iterator, bool>(iterator(this, _size++), true);
+			return _mm512_mask_cmpeq_epi16_mask(static_cast<__mmask32>(live), keys, needle);
 		}
 		
 		
-		template<typename ... Args>
-		std::pair<iterator, bool> emplace(const key_type& key, Args&& ... value_args)
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline unsigned long long avx512_match(__m512i keys, __m512i needle, unsigned long long live, width_4)
 		{
-			if (_size >= max_size())
-			{
-				return std::pair<iterator, bool>(end(), false);
-			}
-			
-			new (&_keys[_size]) key_type(key);
-			new (&_values[_size]) mapped_type(value_args ...);
-			return std::pair<iterator, bool>(iterator(this, _size++), true);
+			return _mm512_mask_cmpeq_epi32_mask(static_cast<__mmask16>(live), keys, needle);
 		}
 		
 		
-		iterator erase(const_iterator it)
+		GDC_NANOMAP_TARGET("avx512f,avx512bw") inline unsigned long long avx512_match(__m512i keys, __m512i needle, unsigned long long live, width_8)
 		{
-			if (it._index == max_size())
-			{
-				std::abort();
-			}
-			
-			_keys[it._index].~key_type();
-			_values[it._index].~mapped_type();
-
-			if (it._index < --_size)
-			{
-				new (&_keys[it._index]) key_type(std::move(_keys[_size]));
-				new (&_values[it._index]) mapped_type(std::move(_values[_size]));
-				_keys[_size].~key_type();
-				_values[_size].~mapped_type();
-			}
-			else
-			{
-				it._index = end()._index;
-			}
-
-			return iterator(it._map, it._index);
+			return _mm512_mask_cmpeq_epi64_mask(static_cast<__mmask8>(live), keys, needle);
 		}
 		
 		
-		mapped_type& operator[](const key_type& key)
+		// The SSE2 and AVX2 kernels compare a whole vector of keys at a time.
+		// Slots between size and capacity belong to the key array, so the last
+		// vector may extend past size as long as it stays within capacity; the
+		// lanes past size are masked out. The match masks have one bit per
+		// byte, so the slot index is the index of the lowest set bit divided by
+		// the key width.
+		template<std::size_t width>
+		GDC_NANOMAP_TARGET("sse2")
+		std::size_t sse2_find(const void* keys, std::size_t size, std::size_t capacity, const void* key)
 		{
-			iterator it = find(key);
+			typedef std::integral_constant<std::size_t, width> tag;
+			constexpr std::size_t lanes = sizeof(__m128i) / width;
+			const unsigned char* p = static_cast<const unsigned char*>(keys);
+			const __m128i needle = sse2_broadcast(key, tag());
+			std::size_t i = 0;
 			
-			if (it == end())
+			for (; i < size && i + lanes <= capacity; i += lanes)
 			{
-				if (_size >= _capacity)
+				unsigned mask = sse2_match(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * width)), needle, tag());
+				
+				if (size - i < lanes)
 				{
-					throw std::overflow_error("nanomap is full");
+					mask &= (1u << ((size - i) * width)) - 1;
 				}
 				
-				size_type i = _size++;
-				new (&_keys[i]) key_type(key);
-				new (&_values[i]) mapped_type();
-				return _values[i];
+				if (mask != 0)
+				{
+					return i + ctz(mask) / width;
+				}
 			}
 			
-			return _values[it._index];
+			return scalar_find<width>(keys, i, size, key);
 		}
 		
 		
-		mapped_type& operator[](key_type&& key)
+		template<std::size_t width>
+		GDC_NANOMAP_TARGET("avx2")
+		std::size_t avx2_find(const void* keys, std::size_t size, std::size_t capacity, const void* key)
 		{
-			iterator it = find(key);
+			typedef std::integral_constant<std::size_t, width> tag;
+			constexpr std::size_t lanes = sizeof(__m256i) / width;
+			const unsigned char* p = static_cast<const unsigned char*>(keys);
+			const __m256i needle = avx2_broadcast(key, tag());
+			std::size_t i = 0;
 			
-			if (it == end())
+			for (; i < size && i + lanes <= capacity; i += lanes)
 			{
-				if (_size >= _capacity)
+				unsigned mask = avx2_match(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i * width)), needle, tag());
+				
+				if (size - i < lanes)
 				{
-					throw std::overflow_error("nanomap is full");
+					mask &= (1u << ((size - i) * width)) - 1;
 				}
 				
-				size_type i = _size++;
-				new (&_keys[i]) key_type(std::move(key));
-				new (&_values[i]) mapped_type();
-				return _values[i];
+				if (mask != 0)
+				{
+					return i + ctz(mask) / width;
+				}
 			}
 			
-			return _values[it._index];
+			return scalar_find<width>(keys, i, size, key);
 		}
 		
 		
-		mapped_type& at(const key_type& key)
+		template<std::size_t width>
+		GDC_NANOMAP_TARGET("avx512f,avx512bw")
+		std::size_t avx512_find(const void* keys, std::size_t size, std::size_t, const void* key)
 		{
-			const_iterator it(_find(key));
+			typedef std::integral_constant<std::size_t, width> tag;
+			constexpr std::size_t lanes = sizeof(__m512i) / width;
+			const unsigned char* p = static_cast<const unsigned char*>(keys);
+			const __m512i needle = avx512_broadcast(key, tag());
 			
-			if (it == end())
+			for (std::size_t i = 0; i < size; i += lanes)
 			{
-				throw std::out_of_range("item not found");
+				const unsigned long long live = size - i < lanes ? (1ull << (size - i)) - 1 : ~0ull;
+				const unsigned long long mask = avx512_match(avx512_load(p + i * width, live, tag()), needle, live, tag());
+				
+				if (mask != 0)
+				{
+					return i + ctz(mask);
+				}
 			}
 			
-			return _values[it._index];
+			return size;
 		}
-
 		
-		const mapped_type& at(const key_type& key) const
-		{
-			mapped_type& item = at(key);
-			return item;
-		}
-
 		
-		size_type count() const
+		// The batch kernels compare each needle against a 64 byte block of
+		// keys held in registers, so the key array is loaded once per block
+		// rather than once per needle. out[j] is set to the slot index of
+		// needles[j], or to size if it is not found. A key block that would
+		// extend past capacity is copied to a local buffer first.
+		template<std::size_t width>
+		inline const unsigned char* key_block(const unsigned char* keys, std::size_t first, std::size_t size, std::size_t capacity, unsigned char* tail)
 		{
-			return _size;
+			if (first + 64 / width <= capacity)
+			{
+				return keys + first * width;
+			}
+			
+			std::memset(tail, 0, 64);
+			std::memcpy(tail, keys + first * width, (size - first) * width);
+			return tail;
 		}
 		
 		
-		const_iterator find(const key_type& key) const
+		template<std::size_t width>
+		inline unsigned long long live_bytes(std::size_t first, std::size_t size)
 		{
-			return _find(key);
+			return size - first < 64 / width ? (1ull << ((size - first) * width)) - 1 : ~0ull;
 		}
 		
 		
-		iterator find(const key_type& key)
+		template<std::size_t width>
+		GDC_NANOMAP_TARGET("sse2")
+		void sse2_find_many(const void* keys, std::size_t size, std::size_t capacity, const void* needles, std::size_t count, std::uint32_t* out)
 		{
-			const_iterator it(_find(key));
-			return iterator(it._map, it._index);
+			typedef std::integral_constant<std::size_t, width> tag;
+			const unsigned char* n = static_cast<const unsigned char*>(needles);
+			unsigned char tail[64];
+			
+			for (std::size_t j = 0; j < count; ++j)
+			{
+				out[j] = static_cast<std::uint32_t>(size);
+			}
+			
+			for (std::size_t first = 0; first < size; first += 64 / width)
+			{
+				const unsigned char* p = key_block<width>(static_cast<const unsigned char*>(keys), first, size, capacity, tail);
+				const __m128i k0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				const __m128i k1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+				const __m128i k2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32));
+				const __m128i k3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 48));
+				const unsigned long long live = live_bytes<width>(first, size);
+				
+				for (std::size_t j = 0; j < count; ++j)
+				{
+					const __m128i needle = sse2_broadcast(n + j * width, tag());
+					const unsigned long long mask = live & (
+						static_cast<unsigned long long>(sse2_match(k0, needle, tag())) |
+						static_cast<unsigned long long>(sse2_match(k1, needle, tag())) << 16 |
+						static_cast<unsigned long long>(sse2_match(k2, needle, tag())) << 32 |
+						static_cast<unsigned long long>(sse2_match(k3, needle, tag())) << 48);
+					
+					if (mask != 0 && out[j] == size)
+					{
+						out[j] = static_cast<std::uint32_t>(first + ctz(mask) / width);
+					}
+				}
+			}
 		}
 		
 		
-		const_iterator begin() const
+		template<std::size_t width>
+		GDC_NANOMAP_TARGET("avx2")
+		void avx2_find_many(const void* keys, std::size_t size, std::size_t capacity, const void* needles, std::size_t count, std::uint32_t* out)
 		{
-			return empty() ? end() : const_iterator(this, 0);
+			typedef std::integral_constant<std::size_t, width> tag;
+			const unsigned char* n = static_cast<const unsigned char*>(needles);
+			unsigned char tail[64];
+			
+			for (std::size_t j = 0; j < count; ++j)
+			{
+				out[j] = static_cast<std::uint32_t>(size);
+			}
+			
+			for (std::size_t first = 0; first < size; first += 64 / width)
+			{
+				const unsigned char* p = key_block<width>(static_cast<const unsigned char*>(keys), first, size, capacity, tail);
+				const __m256i k0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+				const __m256i k1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+				const unsigned long long live = live_bytes<width>(first, size);
+				
+				for (std::size_t j = 0; j < count; ++j)
+				{
+					const __m256i needle = avx2_broadcast(n + j * width, tag());
+					const unsigned long long mask = live & (
+						static_cast<unsigned long long>(avx2_match(k0, needle, tag())) |
+						static_cast<unsigned long long>(avx2_match(k1, needle, tag())) << 32);
+					
+					if (mask != 0 && out[j] == size)
+					{
+						out[j] = static_cast<std::uint32_t>(first + ctz(mask) / width);
+					}
+				}
+			}
 		}
 		
 		
-		const_iterator end() const
+		template<std::size_t width>
+		GDC_NANOMAP_TARGET("avx512f,avx512bw")
+		void avx512_find_many(const void* keys, std::size_t size, std::size_t, const void* needles, std::size_t count, std::uint32_t* out)
 		{
-			return const_iterator(this, max_size());
+			typedef std::integral_constant<std::size_t, width> tag;
+			constexpr std::size_t lanes = sizeof(__m512i) / width;
+			const unsigned char* p = static_cast<const unsigned char*>(keys);
+			const unsigned char* n = static_cast<const unsigned char*>(needles);
+			
+			for (std::size_t j = 0; j < count; ++j)
+			{
+				out[j] = static_cast<std::uint32_t>(size);
+			}
+			
+			for (std::size_t first = 0; first < size; first += lanes)
+			{
+				const unsigned long long live = size - first < lanes ? (1ull << (size - first)) - 1 : ~0ull;
+				const __m512i block = avx512_load(p + first * width, live, tag());
+				
+				for (std::size_t j = 0; j < count; ++j)
+				{
+					const unsigned long long mask = avx512_match(block, avx512_broadcast(n + j * width, tag()), live, tag());
+					
+					if (mask != 0 && out[j] == size)
+					{
+						out[j] = static_cast<std::uint32_t>(first + ctz(mask));
+					}
+				}
+			}
 		}
 		
 		
-		iterator begin()
+		template<std::size_t width>
+		std::size_t plain_find(const void* keys, std::size_t size, std::size_t, const void* key)
 		{
-			return empty() ? end() : iterator(this, 0);
+			return scalar_find<width>(keys, 0, size, key);
 		}
 		
 		
-		iterator end()
+		template<std::size_t width>
+		void plain_find_many(const void* keys, std::size_t size, std::size_t, const void* needles, std::size_t count, std::uint32_t* out)
 		{
-			return iterator(this, max_size());
+			const unsigned char* n = static_cast<const unsigned char*>(needles);
+			
+			for (std::size_t j = 0; j < count; ++j)
+			{
+				out[j] = static_cast<std::uint32_t>(scalar_find<width>(keys, 0, size, n + j * width));
+			}
 		}
 		
 		
-		const_iterator cbegin() const
-		{
-			return empty() ? end() : const_iterator(this, 0);
+		typedef std::size_t (*find_kernel)(const void* keys, std::size_t size, std::size_t capacity, const void* key);
+		typedef void (*find_many_kernel)(const void* keys, std::size_t size, std::size_t capacity, const void* needles, std::size_t count, std::uint32_t* out);
+		
+		
+		struct kernels
+		{
+			find_kernel find;
+			find_many_kernel find_many;
+		};
+		
+		
+		enum class isa
+		{
+			none, sse2, avx2, avx512
+		};
+		
+		
+		// The best instruction set supported by the CPU.
+		inline isa detect_isa()
+		{
+			__builtin_cpu_init();
+			
+			if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+			{
+				return isa::avx512;
+			}
+			
+			if (__builtin_cpu_supports("avx2"))
+			{
+				return isa::avx2;
+			}
+			
+			if (__builtin_cpu_supports("sse2"))
+			{
+				return isa::sse2;
+			}
+			
+			return isa::none;
 		}
 		
 		
-		const_iterator cend() const
+		template<std::size_t width>
+		inline kernels select_kernels(isa level)
 		{
-			return const_iterator(this, max_size());
+			switch (level)
+			{
+				case isa::avx512: return kernels{ &avx512_find<width>, &avx512_find_many<width> };
+				case isa::avx2: return kernels{ &avx2_find<width>, &avx2_find_many<width> };
+				case isa::sse2: return kernels{ &sse2_find<width>, &sse2_find_many<width> };
+				default: return kernels{ &plain_find<width>, &plain_find_many<width> };
+			}
 		}
 		
 		
-	private:
+		// The kernels are chosen on first use and reused for the lifetime of
+		// the process.
+		template<std::size_t width>
+		inline const kernels& simd_kernels()
+		{
+			static const kernels selected = select_kernels<width>(detect_isa());
+			return selected;
+		}
 		
-		std::uint32_t _capacity:16;
-		std::uint32_t _size:16;
-		key_type* _keys;
-		mapped_type* _values;
 		
+		template<std::size_t width>
+		inline std::size_t simd_find(const void* keys, std::size_t size, std::size_t capacity, const void* key)
+		{
+			return simd_kernels<width>().find(keys, size, capacity, key);
+		}
 		
-		const_iterator _find(const key_type& key) const
+		
+		template<std::size_t width>
+		inline void simd_find_many(const void* keys, std::size_t size, std::size_t capacity, const void* needles, std::size_t count, std::uint32_t* out)
+		{
+			simd_kernels<width>().find_many(keys, size, capacity, needles, count, out);
+		}
+		
+		
+#undef GDC_NANOMAP_TARGET
+		
+		
+#endif
+		
+		
+		template<typename key_type, typename key_equal>
+		inline std::size_t linear_find(const key_type* keys, std::size_t size, std::size_t, const key_type& key, std::false_type)
 		{
 			key_equal eq;
 			
-			for (size_type i = 0; i < size(); ++i)
+			for (std::size_t i = 0; i < size; ++i)
 			{
-				if (eq(_keys[i], key))
+				if (eq(keys[i], key))
 				{
-					return const_iterator(this, i);
+					return i;
 				}
 			}
 			
-			return cend();
+			return size;
 		}
 		
 		
-	};
+		template<typename key_type, typename key_equal>
+		inline std::size_t linear_find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key, std::true_type)
+		{
+#if defined(GDC_NANOMAP_SIMD)
+			return simd_find<sizeof(key_type)>(keys, size, capacity, &key);
+#else
+			return linear_find<key_type, key_equal>(keys, size, capacity, key, std::false_type());
+#endif
+		}
+		
+		
+		// Returns the index of key in keys, or size if not found.
+		template<typename key_type, typename key_equal>
+		inline std::size_t linear_find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key)
+		{
+			return linear_find<key_type, key_equal>(keys, size, capacity, key, is_simd_key<key_type, key_equal>());
+		}
+		
+		
+		// Number of needles looked up per call to linear_find_many().
+		constexpr std::size_t batch_size = 64;
+		
+		
+		template<typename key_type, typename key_equal>
+		inline void linear_find_many(const key_type* keys, std::size_t size, std::size_t capacity, const key_type* needles, std::size_t count, std::uint32_t* out, std::false_type)
+		{
+			for (std::size_t j = 0; j < count; ++j)
+			{
+				out[j] = static_cast<std::uint32_t>(linear_find<key_type, key_equal>(keys, size, capacity, needles[j], std::false_type()));
+			}
+		}
+		
+		
+		template<typename key_type, typename key_equal>
+		inline void linear_find_many(const key_type* keys, std::size_t size, std::size_t capacity, const key_type* needles, std::size_t count, std::uint32_t* out, std::true_type)
+		{
+#if defined(GDC_NANOMAP_SIMD)
+			simd_find_many<sizeof(key_type)>(keys, size, capacity, needles, count, out);
+#else
+			linear_find_many<key_type, key_equal>(keys, size, capacity, needles, count, out, std::false_type());
+#endif
+		}
+		
+		
+		// Sets out[j] to the index of needles[j] in keys, or to size if not
+		// found.
+		template<typename key_type, typename key_equal>
+		inline void linear_find_many(const key_type* keys, std::size_t size, std::size_t capacity, const key_type* needles, std::size_t count, std::uint32_t* out)
+		{
+			linear_find_many<key_type, key_equal>(keys, size, capacity, needles, count, out, is_simd_key<key_type, key_equal>());
+		}
+		
+		
+	}
 	
 	
-	template<typename key_type, typename mapped_type, std::uint16_t _capacity, typename key_equal = std::equal_to<key_type>>
-	class nanomap_factory
+	namespace detail
+	{
+		
+		
+		// Column type of search policies that do not need a column.
+		struct no_column
+		{
+		};
+		
+		
+		template<typename search>
+		struct has_column : std::integral_constant<bool, !std::is_same<typename search::column_type, no_column>::value>
+		{
+		};
+		
+		
+		inline std::uint64_t mix(std::size_t hash)
+		{
+			return std::uint64_t(hash) * 0x9e3779b97f4a7c15ull;
+		}
+		
+		
+	}
+	
+	
+	// Search policies decide how nanomap finds a key in its key array. A
+	// policy may keep state of its own, which nanomap keeps up to date by
+	// calling the hooks below whenever the key array changes. A policy may
+	// also ask for a column: an array of column_type with one element per
+	// slot, which is supplied by nanomap_factory, or by the caller of
+	// nanomap::init(). New policies derive from linear_search and override
+	// what they need.
+	template<typename key_type, typename key_equal = std::equal_to<key_type>>
+	class linear_search
 	{
 	public:
 		
-		typedef nanomap<key_type, mapped_type, key_equal> map_type;
-		typedef typename map_type::size_type size_type;
+		typedef detail::no_column column_type;
+		
+		
+		// The number of slots the key array needs past capacity.
+		static constexpr std::size_t extra_slots = 0;
+		
+		
+		// True if erase() must keep the order of the remaining keys. If false,
+		// the last key is moved into the erased slot.
+		static constexpr bool ordered = false;
+		
+		
+		// True if find() only reads the map, so that several threads may
+		// search a map that does not change at the same time.
+		static constexpr bool concurrent_find = true;
+		
+		
+		// True if find() moves the keys it finds, so that the order of the
+		// keys depends on the lookups made and not only on the keys inserted.
+		static constexpr bool self_organizing = false;
+		
+		
+		// True if the policy keeps state on the heap, which it may free or
+		// reallocate whenever the map changes.
+		static constexpr bool allocates = false;
+		
+		
+		// Returns the index at which key is to be inserted.
+		std::size_t position(const key_type*, std::size_t size, const key_type&) const
+		{
+			return size;
+		}
+		
+		
+		// Returns the index to which a key found at index i is to be moved.
+		// The items in between are shifted up by one slot.
+		std::size_t promote(std::size_t i) const
+		{
+			return i;
+		}
+		
+		
+		void attach(column_type*)
+		{
+		}
+		
+		
+		// Called when the map is (re)initialized with size keys.
+		void rebuild(const key_type*, std::size_t)
+		{
+		}
+		
+		
+		// Called after a key has been constructed at index i.
+		void inserted(const key_type*, std::size_t)
+		{
+		}
+		
+		
+		// Called after the key at index from has been moved to index to.
+		void moved(std::size_t, std::size_t)
+		{
+		}
+		
+		
+		// Called after a key has been erased and the key array compacted.
+		void erased(const key_type*, std::size_t)
+		{
+		}
+		
+		
+		void cleared()
+		{
+		}
+		
+		
+		// Returns the index of key, or size if not found.
+		std::size_t find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key) const
+		{
+			return detail::linear_find<key_type, key_equal>(keys, size, capacity, key);
+		}
+		
+		
+		// Sets out[j] to the index of needles[j], or to size if not found.
+		void find_many(const key_type* keys, std::size_t size, std::size_t capacity, const key_type* needles, std::size_t count, std::uint32_t* out) const
+		{
+			detail::linear_find_many<key_type, key_equal>(keys, size, capacity, needles, count, out);
+		}
+		
+		
+	};
+	
+	
+	namespace detail
+	{
 		
 		
-		nanomap_factory() : _map(_keys, _values, _capacity)
+		// Maps a hash to one of 64 bits.
+		inline std::uint64_t filter_bit(std::size_t hash)
 		{
+			return std::uint64_t(1) << (mix(hash) >> 58);
 		}
 		
 		
-		nanomap_factory(const nanomap_factory& f) : _map(_keys, _values, _capacity, f._map.size())
+		// The range of keys in the map, for integral keys only.
+		template<typename key_type, bool = std::is_integral<key_type>::value>
+		class key_range
 		{
-			for (size_type i = 0; i < _capacity; ++i)
+		public:
+			
+			void clear()
 			{
-				new (&_keys[i]) key_type(f._keys[i]);
 			}
 			
-			for (size_type i = 0; i < _capacity; ++i)
+			
+			void add(const key_type&)
 			{
-				new (&_values[i]) mapped_type(f._values[i]);
 			}
-		}
+			
+			
+			bool contains(const key_type&) const
+			{
+				return true;
+			}
+			
+			
+		};
 		
 		
-		nanomap_factory(nanomap_factory&& f) : _map(_keys, _values, _capacity, f._map.size())
+		template<typename key_type>
+		class key_range<key_type, true>
 		{
-			for (size_type i = 0; i < _capacity; ++i)
+		public:
+			
+			key_range()
+			{
+				clear();
+			}
+			
+			
+			void clear()
+			{
+				_min = std::numeric_limits<key_type>::max();
+				_max = std::numeric_limits<key_type>::lowest();
+			}
+			
+			
+			void add(const key_type& key)
 			{
-				new (&_keys[i]) key_type(std::move(f._keys[i]));
+				_min = std::min(_min, key);
+				_max = std::max(_max, key);
 			}
 			
-			for (size_type i = 0; i < _capacity; ++i)
+			
+			bool contains(const key_type& key) const
 			{
-				new (&_values[i]) mapped_type(std::move(f._values[i]));
+				return key >= _min && key <= _max;
 			}
 			
-			f._map.clear();
+			
+		private:
+			
+			key_type _min;
+			key_type _max;
+			
+			
+		};
+		
+		
+	}
+	
+	
+	// Linear search that first checks the key against a summary of the keys
+	// in the map: one bit per hash bucket out of 64 and, for integral keys,
+	// the key range. Most keys that are not in the map are rejected without
+	// scanning the key array, which pays off when most lookups miss. Erasing
+	// rebuilds the summary from the remaining keys.
+	template<typename key_type, typename key_equal = std::equal_to<key_type>, typename hash = std::hash<key_type>>
+	class filtered_search : public linear_search<key_type, key_equal>
+	{
+	public:
+		
+		filtered_search() : _bits(0)
+		{
 		}
 		
 		
-		constexpr size_type capacity() const
+		void rebuild(const key_type* keys, std::size_t size)
 		{
-			return _capacity;
+			cleared();
+			
+			for (std::size_t i = 0; i < size; ++i)
+			{
+				inserted(keys, i);
+			}
 		}
 		
 		
-		map_type& get()
+		void inserted(const key_type* keys, std::size_t i)
 		{
-			return _map;
+			_bits |= detail::filter_bit(hash()(keys[i]));
+			_range.add(keys[i]);
+		}
+		
+		
+		void erased(const key_type* keys, std::size_t size)
+		{
+			rebuild(keys, size);
+		}
+		
+		
+		void cleared()
+		{
+			_bits = 0;
+			_range.clear();
+		}
+		
+		
+		bool may_contain(const key_type& key) const
+		{
+			return _range.contains(key) && (_bits & detail::filter_bit(hash()(key))) != 0;
+		}
+		
+		
+		std::size_t find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key) const
+		{
+			return may_contain(key) ? linear_search<key_type, key_equal>::find(keys, size, capacity, key) : size;
 		}
 		
 		
 	private:
 		
-		map_type _map;
-		key_type _keys[_capacity];
-		mapped_type _values[_capacity];
+		std::uint64_t _bits;
+		detail::key_range<key_type> _range;
 		
 		
 	};
 	
 	
+	namespace detail
+	{
+		
+		
+		// A one byte fingerprint of a hash.
+		struct tag_fingerprint
+		{
+			typedef std::uint8_t type;
+			
+			
+			static type of(std::size_t hash)
+			{
+				return static_cast<type>(mix(hash) >> 56);
+			}
+		};
+		
+		
+		// The full hash.
+		struct hash_fingerprint
+		{
+			typedef std::size_t type;
+			
+			
+			static type of(std::size_t hash)
+			{
+				return hash;
+			}
+		};
+		
+		
+		// Linear search that keeps a fingerprint of each key's hash in a
+		// column. The column is scanned with SIMD instructions, and key_equal
+		// is invoked only for the slots whose fingerprint matches.
+		template<typename key_type, typename key_equal, typename hash, typename fingerprint>
+		class fingerprint_search : public linear_search<key_type, key_equal>
+		{
+		public:
+			
+			typedef typename fingerprint::type column_type;
+			
+			
+			fingerprint_search() : _column(nullptr)
+			{
+			}
+			
+			
+			void attach(column_type* column)
+			{
+				_column = column;
+			}
+			
+			
+			void rebuild(const key_type* keys, std::size_t size)
+			{
+				for (std::size_t i = 0; i < size; ++i)
+				{
+					inserted(keys, i);
+				}
+			}
+			
+			
+			void inserted(const key_type* keys, std::size_t i)
+			{
+				_column[i] = fingerprint::of(hash()(keys[i]));
+			}
+			
+			
+			void moved(std::size_t from, std::size_t to)
+			{
+				_column[to] = _column[from];
+			}
+			
+			
+			std::size_t find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key) const
+			{
+				return find(keys, size, capacity, key, hash()(key));
+			}
+			
+			
+			// h must be hash()(key).
+			std::size_t find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key, std::size_t h) const
+			{
+				const column_type f = fingerprint::of(h);
+				key_equal eq;
+				
+				for (std::size_t i = 0; i < size; ++i)
+				{
+					i += linear_find<column_type, std::equal_to<column_type>>(_column + i, size - i, capacity - i, f);
+					
+					if (i < size && eq(keys[i], key))
+					{
+						return i;
+					}
+				}
+				
+				return size;
+			}
+			
+			
+			void find_many(const key_type* keys, std::size_t size, std::size_t capacity, const key_type* needles, std::size_t count, std::uint32_t* out) const
+			{
+				for (std::size_t j = 0; j < count; ++j)
+				{
+					out[j] = static_cast<std::uint32_t>(find(keys, size, capacity, needles[j]));
+				}
+			}
+			
+			
+		private:
+			
+			column_type* _column;
+			
+			
+		};
+		
+		
+	}
+	
+	
+	// Linear search for keys that are expensive to compare, such as strings.
+	// A one byte fingerprint of each key's hash is kept in a column, and
+	// key_equal is invoked only for the slots whose fingerprint matches.
+	template<typename key_type, typename key_equal = std::equal_to<key_type>, typename hash = std::hash<key_type>>
+	class tagged_search : public detail::fingerprint_search<key_type, key_equal, hash, detail::tag_fingerprint>
+	{
+	};
+	
+	
+	// Like tagged_search, but the column holds the full hash of each key, so
+	// key_equal is practically only invoked for the key that matches. Callers
+	// that have already hashed the key can pass the hash to
+	// nanomap::find(key, hash) to skip hashing it again.
+	template<typename key_type, typename key_equal = std::equal_to<key_type>, typename hash = std::hash<key_type>>
+	class hashed_search : public detail::fingerprint_search<key_type, key_equal, hash, detail::hash_fingerprint>
+	{
+	};
+	
+	
+	// Linear search while the map holds at most threshold keys. When it grows
+	// past that, an open addressing hash table of indices into the key array
+	// is built, and lookups probe it instead of scanning. The table is
+	// dropped again when the map shrinks below threshold / 2. The keys and
+	// values stay where they are, so iterators and indices behave as with
+	// linear_search(). The table is allocated on the heap and holds two to
+	// four 8-byte entries per key, plus a 4-byte table position per key:
+	// 20 to 36 bytes per key. Neither shrinks when keys are erased, until
+	// the table is dropped.
+	template<typename key_type, typename key_equal = std::equal_to<key_type>, typename hash = std::hash<key_type>, std::size_t threshold = 32>
+	class indexed_search : public linear_search<key_type, key_equal>
+	{
+	public:
+		
+		static constexpr bool allocates = true;
+		
+		
+		indexed_search() : _keys(nullptr), _size(0), _shift(32)
+		{
+		}
+		
+		
+		bool indexed() const
+		{
+			return !_table.empty();
+		}
+		
+		
+		void rebuild(const key_type* keys, std::size_t size)
+		{
+			_keys = keys;
+			_size = size;
+			
+			if (size > threshold)
+			{
+				_build(size);
+			}
+			else
+			{
+				_drop();
+			}
+		}
+		
+		
+		void inserted(const key_type* keys, std::size_t i)
+		{
+			_keys = keys;
+			++_size;
+			
+			if (!indexed())
+			{
+				if (_size > threshold)
+				{
+					_build(_size);
+				}
+			}
+			else if (_size * 2 > _table.size())
+			{
+				_build(_size);
+			}
+			else
+			{
+				_add(i);
+			}
+		}
+		
+		
+		// The key at index to is overwritten, so its entry goes first.
+		void moved(std::size_t from, std::size_t to)
+		{
+			if (indexed())
+			{
+				_remove(to);
+				_where[to] = _where[from];
+				_where[from] = none;
+				_table[_where[to]].index = static_cast<std::uint32_t>(to);
+			}
+		}
+		
+		
+		void erased(const key_type* keys, std::size_t size)
+		{
+			_keys = keys;
+			_size = size;
+			
+			if (indexed())
+			{
+				// Erasing the last key moves nothing.
+				_remove(size);
+				
+				if (size < threshold / 2)
+				{
+					_drop();
+				}
+			}
+		}
+		
+		
+		void cleared()
+		{
+			_size = 0;
+			_drop();
+		}
+		
+		
+		std::size_t find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key) const
+		{
+			return indexed() ? find(keys, size, capacity, key, hash()(key)) : linear_search<key_type, key_equal>::find(keys, size, capacity, key);
+		}
+		
+		
+		// h must be hash()(key).
+		std::size_t find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key, std::size_t h) const
+		{
+			if (!indexed())
+			{
+				return linear_search<key_type, key_equal>::find(keys, size, capacity, key);
+			}
+			
+			const std::uint32_t h32 = _hash32(h);
+			const std::size_t mask = _table.size() - 1;
+			key_equal eq;
+			
+			for (std::size_t p = h32 >> _shift; _table[p].index != none; p = (p + 1) & mask)
+			{
+				if (_table[p].h32 == h32 && eq(keys[_table[p].index], key))
+				{
+					return _table[p].index;
+				}
+			}
+			
+			return size;
+		}
+		
+		
+		void find_many(const key_type* keys, std::size_t size, std::size_t capacity, const key_type* needles, std::size_t count, std::uint32_t* out) const
+		{
+			if (!indexed())
+			{
+				linear_search<key_type, key_equal>::find_many(keys, size, capacity, needles, count, out);
+				return;
+			}
+			
+			for (std::size_t j = 0; j < count; ++j)
+			{
+				out[j] = static_cast<std::uint32_t>(find(keys, size, capacity, needles[j]));
+			}
+		}
+		
+		
+	private:
+		
+		struct entry
+		{
+			std::uint32_t index;
+			std::uint32_t h32;
+		};
+		
+		
+		static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+		
+		
+		const key_type* _keys;
+		std::size_t _size;
+		unsigned _shift;
+		std::vector<entry> _table;
+		
+		// The table position of the entry for each key.
+		std::vector<std::uint32_t> _where;
+		
+		
+		static std::uint32_t _hash32(std::size_t h)
+		{
+			return static_cast<std::uint32_t>(detail::mix(h) >> 32);
+		}
+		
+		
+		// Builds a table with at least twice as many entries as keys.
+		void _build(std::size_t keys)
+		{
+			std::size_t n = 2;
+			_shift = 31;
+			
+			while (n < keys * 2)
+			{
+				n *= 2;
+				--_shift;
+			}
+			
+			_table.assign(n, entry{ none, 0 });
+			_where.assign(_size, std::uint32_t(none));
+			
+			for (std::size_t i = 0; i < _size; ++i)
+			{
+				_add(i);
+			}
+		}
+		
+		
+		void _drop()
+		{
+			std::vector<entry>().swap(_table);
+			std::vector<std::uint32_t>().swap(_where);
+		}
+		
+		
+		void _add(std::size_t i)
+		{
+			const std::uint32_t h32 = _hash32(hash()(_keys[i]));
+			const std::size_t mask = _table.size() - 1;
+			std::size_t p = h32 >> _shift;
+			
+			while (_table[p].index != none)
+			{
+				p = (p + 1) & mask;
+			}
+			
+			_table[p] = entry{ static_cast<std::uint32_t>(i), h32 };
+			
+			if (i >= _where.size())
+			{
+				_where.resize(i + 1, std::uint32_t(none));
+			}
+			
+			_where[i] = static_cast<std::uint32_t>(p);
+		}
+		
+		
+		// Removes the entry for the key at index i, if there is one, and
+		// shifts back the entries that follow it in the same run.
+		void _remove(std::size_t i)
+		{
+			if (i >= _where.size() || _where[i] == none)
+			{
+				return;
+			}
+			
+			const std::size_t mask = _table.size() - 1;
+			std::size_t p = _where[i];
+			_where[i] = none;
+			
+			for (std::size_t q = (p + 1) & mask; _table[q].index != none; q = (q + 1) & mask)
+			{
+				const std::size_t home = _table[q].h32 >> _shift;
+				
+				if (((q - home) & mask) >= ((q - p) & mask))
+				{
+					_table[p] = _table[q];
+					_where[_table[p].index] = static_cast<std::uint32_t>(p);
+					p = q;
+				}
+			}
+			
+			_table[p].index = none;
+		}
+		
+		
+	};
+	
+	
+	// Binary search over keys kept in ascending order. Inserting and erasing
+	// shift the following items, so both cost O(size), but lookups cost
+	// O(log(size)), which beats a linear scan in maps with hundreds of keys.
+	// The binary search is branchless: each step compiles to a conditional
+	// move, so there are no mispredicted branches. Iteration visits the keys
+	// in order. A map passed to nanomap::init() must already be sorted.
+	template<typename key_type, typename key_equal = std::equal_to<key_type>, typename key_compare = std::less<key_type>>
+	class sorted_search : public linear_search<key_type, key_equal>
+	{
+	public:
+		
+		static constexpr bool ordered = true;
+		
+		
+		// Returns the index of the first key that is not less than key.
+		std::size_t position(const key_type* keys, std::size_t size, const key_type& key) const
+		{
+			if (size == 0)
+			{
+				return 0;
+			}
+			
+			key_compare less;
+			const key_type* base = keys;
+			
+			while (size > 1)
+			{
+				const std::size_t half = size / 2;
+				base = less(base[half - 1], key) ? base + half : base;
+				size -= half;
+			}
+			
+			return static_cast<std::size_t>(base - keys) + less(*base, key);
+		}
+		
+		
+		// Keys that can be scanned with SIMD instructions are narrowed down to
+		// a run of 128 bytes by binary search, and the run is then scanned.
+		// That is faster than searching all the way down.
+		std::size_t find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key) const
+		{
+			if (!detail::is_simd_key<key_type, key_equal>::value)
+			{
+				const std::size_t i = position(keys, size, key);
+				return i < size && key_equal()(keys[i], key) ? i : size;
+			}
+			
+			constexpr std::size_t run = 128 / sizeof(key_type);
+			key_compare less;
+			const key_type* base = keys;
+			std::size_t n = size;
+			
+			while (n > run)
+			{
+				const std::size_t half = n / 2;
+				base = less(base[half - 1], key) ? base + half : base;
+				n -= half;
+			}
+			
+			const std::size_t first = static_cast<std::size_t>(base - keys);
+			const std::size_t i = detail::linear_find<key_type, key_equal>(base, n, capacity - first, key);
+			return i < n ? first + i : size;
+		}
+		
+		
+		void find_many(const key_type* keys, std::size_t size, std::size_t capacity, const key_type* needles, std::size_t count, std::uint32_t* out) const
+		{
+			for (std::size_t j = 0; j < count; ++j)
+			{
+				out[j] = static_cast<std::uint32_t>(find(keys, size, capacity, needles[j]));
+			}
+		}
+		
+		
+	};
+	
+	
+	// Linear search that stores the key being searched for in the slot past
+	// the last key, so the scan always finds it and needs no bounds check.
+	// The key array needs one slot more than the map's capacity:
+	// nanomap_factory reserves it, and callers of nanomap::init() must too.
+	// Keys must be trivially copyable, and key_equal must find every key
+	// equal to itself. Because find() writes to the key array, a map using
+	// this policy must not be searched from several threads at the same
+	// time. Keys that are scanned with SIMD instructions do not benefit,
+	// and are searched like with linear_search().
+	template<typename key_type, typename key_equal = std::equal_to<key_type>>
+	class sentinel_search : public linear_search<key_type, key_equal>
+	{
+	public:
+		
+		static_assert(std::is_trivially_copyable<key_type>::value, "sentinel_search needs trivially copyable keys");
+		static_assert(!std::is_floating_point<key_type>::value, "NaN is not equal to itself");
+		
+		
+		static constexpr std::size_t extra_slots = 1;
+		
+		
+		// find() writes the key it looks for past the last key.
+		static constexpr bool concurrent_find = false;
+		
+		
+		std::size_t find(const key_type* keys, std::size_t size, std::size_t capacity, const key_type& key) const
+		{
+			if (detail::is_simd_key<key_type, key_equal>::value)
+			{
+				return linear_search<key_type, key_equal>::find(keys, size, capacity, key);
+			}
+			
+			// The slot past the last key is not part of the map.
+			key_type* k = const_cast<key_type*>(keys);
+			std::memcpy(static_cast<void*>(k + size), &key, sizeof(key_type));
+			key_equal eq;
+			std::size_t i = 0;
+			
+			while (!eq(k[i], key))
+			{
+				++i;
+			}
+			
+			return i;
+		}
+		
+		
+	};
+	
+	
+	namespace detail
+	{
+		
+		
+		// Layout of the key array of unrolled_search: the array is padded to
+		// whole SSE2 vectors, or to whole 64 byte blocks if it is larger than
+		// one block, so that every vector can be loaded in full.
+		template<typename key_type, std::size_t capacity>
+		struct unrolled_layout
+		{
+			static constexpr std::size_t bytes = capacity * sizeof(key_type);
+			static constexpr std::size_t granule = bytes <= 64 ? 16 : 64;
+			static constexpr std::size_t padded_bytes = (bytes + granule - 1) / granule * granule;
+			static constexpr std::size_t extra_slots = padded_bytes / sizeof(key_type) - capacity;
+			static constexpr std::size_t block_vectors = padded_bytes < 64 ? padded_bytes / 16 : 4;
+		};
+		
+		
+	}
+	
+	
+	// Linear search over a capacity known at compile time. The loop over the
+	// key array is bounded by a constant, so the compiler unrolls it, and it
+	// stops at size, so a lookup costs time in proportion to the size of the
+	// map rather than its capacity. Keys that can be scanned with SIMD
+	// instructions are compared with straight-line SSE2 code, one 64 byte
+	// block at a time, and the slots past size are masked out. This avoids the indirect call to the kernel
+	// chosen at run time, which pays off for maps of up to a few dozen keys.
+	// Used by static_nanomap.
+	template<typename key_type, std::size_t capacity, typename key_equal = std::equal_to<key_type>>
+	class unrolled_search : public linear_search<key_type, key_equal>
+	{
+	public:
+		
+#if defined(GDC_NANOMAP_SIMD) && defined(__SSE2__)
+		typedef detail::is_simd_key<key_type, key_equal> simd;
+#else
+		typedef std::false_type simd;
+#endif
+		
+		
+		static constexpr std::size_t extra_slots = simd::value ? detail::unrolled_layout<key_type, capacity>::extra_slots : 0;
+		
+		
+		std::size_t find(const key_type* keys, std::size_t size, std::size_t, const key_type& key) const
+		{
+			return find(keys, size, key, simd());
+		}
+		
+		
+	private:
+		
+		std::size_t find(const key_type* keys, std::size_t size, const key_type& key, std::false_type) const
+		{
+			key_equal eq;
+			
+			for (std::size_t i = 0; i < capacity && i < size; ++i)
+			{
+				if (eq(keys[i], key))
+				{
+					return i;
+				}
+			}
+			
+			return size;
+		}
+		
+		
+#if defined(GDC_NANOMAP_SIMD) && defined(__SSE2__)
+		std::size_t find(const key_type* keys, std::size_t size, const key_type& key, std::true_type) const
+		{
+			typedef detail::unrolled_layout<key_type, capacity> layout;
+			constexpr std::size_t width = sizeof(key_type);
+			typedef std::integral_constant<std::size_t, width> tag;
+			const unsigned char* p = reinterpret_cast<const unsigned char*>(keys);
+			const __m128i needle = detail::sse2_broadcast(&key, tag());
+			
+			for (std::size_t first = 0; first < capacity && first < size; first += 64 / width)
+			{
+				const unsigned char* block = p + first * width;
+				unsigned long long mask = detail::live_bytes<width>(first, size);
+				unsigned long long match = 0;
+				
+				for (std::size_t v = 0; v < layout::block_vectors; ++v)
+				{
+					const __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + v * 16));
+					match |= static_cast<unsigned long long>(detail::sse2_match(k, needle, tag())) << (v * 16);
+				}
+				
+				mask &= match;
+				
+				if (mask != 0)
+				{
+					return first + detail::ctz(mask) / width;
+				}
+			}
+			
+			return size;
+		}
+#endif
+		
+		
+	};
+	
+	
+	namespace detail
+	{
+		
+		
+		// The number of keys that the SIMD kernels compare in their first 64
+		// bytes, or 1 for keys that are not scanned with SIMD. A
+		// self-organizing search does not move the keys in these slots.
+		template<typename key_type, typename key_equal>
+		struct front_slots : std::integral_constant<std::size_t, is_simd_key<key_type, key_equal>::value ? 64 / sizeof(key_type) : 1>
+		{
+		};
+		
+		
+	}
+	
+	
+	// Linear search that moves each key it finds toward the front of the map,
+	// by as many slots as the SIMD kernels compare at once, or by one slot for
+	// keys that are not scanned with SIMD. The items in between move back by
+	// one slot. Keys in the first SIMD block cost the same to find wherever
+	// they are, so finding them moves nothing. Frequently used keys enter the
+	// block and push the keys there out, so they gather at the front, where
+	// the scan reaches them first. Because find() reorders the map,
+	// it invalidates all iterators except the one it returns, even when
+	// invoked on a const map, and a map using this policy must not be
+	// searched from several threads at the same time. find_many() and
+	// count_many() do not reorder the map.
+	template<typename key_type, typename key_equal = std::equal_to<key_type>>
+	class transpose_search : public linear_search<key_type, key_equal>
+	{
+	public:
+		
+		static constexpr bool concurrent_find = false;
+		static constexpr bool self_organizing = true;
+		
+		
+		std::size_t promote(std::size_t i) const
+		{
+			return i < detail::front_slots<key_type, key_equal>::value ? i : i - detail::front_slots<key_type, key_equal>::value;
+		}
+		
+		
+	};
+	
+	
+	// Like transpose_search, but moves each key it finds to the front of the
+	// map. Adapts faster than transpose_search when the set of frequently
+	// used keys changes, but moves more items per lookup.
+	template<typename key_type, typename key_equal = std::equal_to<key_type>>
+	class move_to_front_search : public linear_search<key_type, key_equal>
+	{
+	public:
+		
+		static constexpr bool concurrent_find = false;
+		static constexpr bool self_organizing = true;
+		
+		
+		std::size_t promote(std::size_t i) const
+		{
+			return i < detail::front_slots<key_type, key_equal>::value ? i : 0;
+		}
+		
+		
+	};
+	
+	
+	// True if an object of type T can be moved to another address by
+	// copying its bytes, after which it is not destroyed at the old address.
+	// nanomap then moves items with memcpy() and memmove(). True for
+	// trivially copyable types, and may be specialized for others.
+	template<typename T>
+	struct is_trivially_relocatable : std::is_trivially_copyable<T>
+	{
+	};
+	
+	
+	namespace detail
+	{
+		
+		
+		template<typename value_type>
+		inline void destroy(value_type* first, std::size_t size)
+		{
+			if (!std::is_trivially_destructible<value_type>::value)
+			{
+				for (std::size_t i = 0; i < size; ++i)
+				{
+					first[i].~value_type();
+				}
+			}
+		}
+		
+		
+		template<typename value_type>
+		inline void relocate(value_type* from, std::size_t size, value_type* to, std::true_type)
+		{
+			if (size > 0)
+			{
+				std::memmove(static_cast<void*>(to), static_cast<const void*>(from), size * sizeof(value_type));
+			}
+		}
+		
+		
+		template<typename value_type>
+		inline void relocate(value_type* from, std::size_t size, value_type* to, std::false_type)
+		{
+			// Overlapping ranges are moved starting from the end that is
+			// moved away from.
+			for (std::size_t k = 0; k < size; ++k)
+			{
+				const std::size_t i = to < from ? k : size - 1 - k;
+				new (&to[i]) value_type(std::move(from[i]));
+				from[i].~value_type();
+			}
+		}
+		
+		
+		// Moves size objects to the unconstructed slots at to, leaving the
+		// slots at from unconstructed. The ranges may overlap.
+		template<typename value_type>
+		inline void relocate(value_type* from, std::size_t size, value_type* to)
+		{
+			relocate(from, size, to, is_trivially_relocatable<value_type>());
+		}
+		
+		
+	}
+	
+	
+	template<typename key_type, typename mapped_type, typename key_equal, typename search, typename _size_type> class nanomap;
+	
+	
+	template<bool is_const, typename key_type, typename mapped_type, typename key_equal, typename search, typename _size_type>
+	class nanomap_iterator
+	{
+	public:
+		
+		typedef nanomap<key_type, mapped_type, key_equal, search, _size_type> map_type;
+		typedef typename map_type::reference reference;
+		typedef typename map_type::const_reference const_reference;
+		typedef typename map_type::size_type size_type;
+		typedef typename std::pair<const key_type&, reference> value_type;
+		typedef typename std::conditional<is_const, const_reference, reference>::type ref;
+		typedef nanomap_iterator<false, key_type, mapped_type, key_equal, search, _size_type> iterator;
+		typedef nanomap_iterator<true, key_type, mapped_type, key_equal, search, _size_type> const_iterator;
+		friend map_type;
+		friend const_iterator;
+		friend iterator;
+		
+		
+		nanomap_iterator(map_type* map, size_type index) : _map(map), _index(index)
+		{
+		}
+		
+		
+		nanomap_iterator(const map_type* map, size_type index) : _map(const_cast<map_type*>(map)), _index(index)
+		{
+		}
+		
+		
+		// Note: this allows const_iterator(const iterator&).
+		template<typename IT = nanomap_iterator>
+		nanomap_iterator(const IT& it) : _map(const_cast<map_type*>(it._map)), _index(it._index)
+		{
+			static_assert(
+				std::is_same<IT, nanomap_iterator>::value ||
+				std::is_same<IT, iterator>::value, "Invalid iterator type");
+		}
+		
+		
+		// Note: this allows const_iterator(const iterator&&).
+		template<typename IT = nanomap_iterator>
+		nanomap_iterator(IT&& it) : _map(it._map), _index(it._index)
+		{
+			if (it._map != nullptr)
+			{
+				it._index = it._map->max_size();
+			}
+			
+			it._map = nullptr;
+		}
+		
+		
+		nanomap_iterator() : nanomap_iterator(nullptr, 0)
+		{
+		}
+		
+		
+		~nanomap_iterator() = default;
+		
+		
+		template<typename IT = nanomap_iterator>
+		nanomap_iterator& operator=(const nanomap_iterator& it)
+		{
+			static_assert(
+				std::is_same<IT, nanomap_iterator>::value ||
+				std::is_same<IT, iterator>::value, "Invalid type");
+			_map = it._map;
+			_index = it._index;
+			return *this;
+		}
+		
+		
+		nanomap_iterator& operator=(nanomap_iterator&& it)
+		{
+			_map = it._map;
+			_index = it._index;
+			
+			if (it._map != nullptr)
+			{
+				it._index = it._map->max_size();
+				it._map = nullptr;
+			}
+			
+			return *this;
+		}
+		
+		
+		nanomap_iterator& operator++()
+		{
+			if (++_index >= _map->size())
+			{
+				_index = _map->max_size();
+			}
+			
+			return *this;
+		}
+		
+		
+		nanomap_iterator& operator++(int)
+		{
+			nanomap_iterator tmp(*this);
+			operator++();
+			return tmp;
+		}
+		
+		
+		bool operator==(const iterator& rhs) const
+		{
+			return _map != nullptr && _map == rhs._map && _index == rhs._index;
+		}
+		
+		
+		bool operator==(const const_iterator& rhs) const
+		{
+			return _map != nullptr && _map == rhs._map && _index == rhs._index;
+		}
+		
+		
+		bool operator!=(const iterator& rhs) const
+		{
+			return _map == nullptr || rhs._map == nullptr || _map != rhs._map || _index != rhs._index;
+		}
+		
+		
+		bool operator!=(const const_iterator& rhs) const
+		{
+			return _map == nullptr || rhs._map == nullptr || _map != rhs._map || _index != rhs._index;
+		}
+		
+		
+		value_type operator*()
+		{
+			return value_type(_map->_keys[_index], _map->_values[_index]);
+		}
+		
+		
+		const key_type& key() const
+		{
+			return _map->_keys[_index];
+		}
+		
+		
+		ref& value()
+		{
+			return _map->_values[_index];
+		}
+		
+		
+	private:
+		
+		map_type* _map;
+		size_type _index;
+		
+	};
+	
+	
+	// _size_type is the type of sizes and indices, and limits the capacity
+	// of the map: std::uint8_t, std::uint16_t or std::uint32_t. The capacity
+	// is at most its maximum value, which is the index of end(). The search
+	// policy is a private base, so that a stateless policy takes no space.
+	template<typename key_type, typename mapped_type, typename key_equal = std::equal_to<key_type>, typename search = linear_search<key_type, key_equal>, typename _size_type = std::uint16_t>
+	class nanomap : private search
+	{
+	public:
+		
+		static_assert(std::is_unsigned<_size_type>::value && sizeof(_size_type) <= sizeof(std::uint32_t), "Invalid size type");
+		
+		
+		typedef _size_type size_type;
+		typedef mapped_type& reference;
+		typedef const mapped_type& const_reference;
+		typedef std::pair<const key_type, mapped_type> value_type;
+		typedef nanomap_iterator<false, key_type, mapped_type, key_equal, search, _size_type> iterator;
+		typedef nanomap_iterator<true, key_type, mapped_type, key_equal, search, _size_type> const_iterator;
+		typedef typename search::column_type column_type;
+		friend iterator;
+		friend const_iterator;
+		
+		
+		nanomap() : _capacity(0), _size(0), _keys(nullptr), _values(nullptr)
+		{
+		}
+		
+		
+		nanomap(key_type* keys, mapped_type* values, size_type capacity, size_type size = 0) :
+			_capacity(capacity), _size(size), _keys(keys), _values(values)
+		{
+			static_assert(!detail::has_column<search>::value, "The search policy needs a column");
+			_search().rebuild(_keys, _size);
+		}
+		
+		
+		// For search policies that need a column. column must have room for
+		// capacity elements.
+		nanomap(key_type* keys, mapped_type* values, column_type* column, size_type capacity, size_type size = 0) :
+			_capacity(capacity), _size(size), _keys(keys), _values(values)
+		{
+			_search().attach(column);
+			_search().rebuild(_keys, _size);
+		}
+		
+		
+		nanomap(const nanomap&) = delete;
+		nanomap(nanomap&&) = delete;
+		
+		
+		~nanomap()
+		{
+			clear();
+		}
+		
+		
+		void init(key_type* keys, mapped_type* values, size_type capacity, size_type size = 0)
+		{
+			static_assert(!detail::has_column<search>::value, "The search policy needs a column");
+			_capacity = capacity;
+			_size = size;
+			_keys = keys;
+			_values = values;
+			_search().rebuild(_keys, _size);
+		}
+		
+		
+		// For search policies that need a column. column must have room for
+		// capacity elements.
+		void init(key_type* keys, mapped_type* values, column_type* column, size_type capacity, size_type size = 0)
+		{
+			_capacity = capacity;
+			_size = size;
+			_keys = keys;
+			_values = values;
+			_search().attach(column);
+			_search().rebuild(_keys, _size);
+		}
+		
+		
+		bool empty() const
+		{
+			return _size == 0;
+		}
+		
+		
+		size_type size() const
+		{
+			return _size;
+		}
+		
+		
+		size_type max_size() const
+		{
+			return _capacity;
+		}
+		
+		
+		void clear()
+		{
+			detail::destroy(_keys, _size);
+			detail::destroy(_values, _size);
+			_size = 0;
+			_search().cleared();
+		}
+		
+		
+		std::pair<iterator, bool> insert(const value_type& item)
+		{
+			if (_size >= max_size())
+			{
+				return std::pair<iterator, bool>(end(), false);
+			}
+			
+			return std::pair<iterator, bool>(iterator(this, _insert(item.first, item.second)), true);
+		}
+		
+		
+		template<typename ... Args>
+		std::pair<iterator, bool> emplace(const key_type& key, Args&& ... value_args)
+		{
+			if (_size >= max_size())
+			{
+				return std::pair<iterator, bool>(end(), false);
+			}
+			
+			return std::pair<iterator, bool>(iterator(this, _insert(key, std::forward<Args>(value_args) ...)), true);
+		}
+		
+		
+		iterator erase(const_iterator it)
+		{
+			if (it._index == max_size())
+			{
+				std::abort();
+			}
+			
+			detail::destroy(_keys + it._index, 1);
+			detail::destroy(_values + it._index, 1);
+
+			if (it._index < --_size)
+			{
+				if (search::ordered)
+				{
+					// Shift the following items down to keep the order.
+					_shift(it._index + 1, _size - it._index, it._index);
+				}
+				else
+				{
+					_move(_size, it._index);
+				}
+			}
+			else
+			{
+				it._index = end()._index;
+			}
+			
+			_search().erased(_keys, _size);
+			return iterator(it._map, it._index);
+		}
+		
+		
+		mapped_type& operator[](const key_type& key)
+		{
+			iterator it = find(key);
+			
+			if (it == end())
+			{
+				if (_size >= _capacity)
+				{
+					throw std::overflow_error("nanomap is full");
+				}
+				
+				return _values[_insert(key)];
+			}
+			
+			return _values[it._index];
+		}
+		
+		
+		mapped_type& operator[](key_type&& key)
+		{
+			iterator it = find(key);
+			
+			if (it == end())
+			{
+				if (_size >= _capacity)
+				{
+					throw std::overflow_error("nanomap is full");
+				}
+				
+				return _values[_insert(std::move(key))];
+			}
+			
+			return _values[it._index];
+		}
+		
+		
+		mapped_type& at(const key_type& key)
+		{
+			const_iterator it(_find(key));
+			
+			if (it == end())
+			{
+				throw std::out_of_range("item not found");
+			}
+			
+			return _values[it._index];
+		}
+
+		
+		const mapped_type& at(const key_type& key) const
+		{
+			mapped_type& item = at(key);
+			return item;
+		}
+
+		
+		size_type count() const
+		{
+			return _size;
+		}
+		
+		
+		const_iterator find(const key_type& key) const
+		{
+			return _find(key);
+		}
+		
+		
+		iterator find(const key_type& key)
+		{
+			const_iterator it(_find(key));
+			return iterator(it._map, it._index);
+		}
+		
+		
+		// For search policies that hash keys, such as hashed_search(). hash
+		// must be the hash of key as computed by the search policy.
+		const_iterator find(const key_type& key, std::size_t hash) const
+		{
+			const size_type n = size();
+			const std::size_t i = _search().find(_keys, n, max_size(), key, hash);
+			return i < n ? const_iterator(this, static_cast<size_type>(i)) : cend();
+		}
+		
+		
+		iterator find(const key_type& key, std::size_t hash)
+		{
+			const_iterator it(static_cast<const nanomap*>(this)->find(key, hash));
+			return iterator(it._map, it._index);
+		}
+		
+		
+		// Looks up every key in [first, last) and stores its index in
+		// indices, or max_size() if not found. An index can be turned into an
+		// iterator with iterator(&map, index). Returns the number of keys
+		// found. Much faster than calling find() for each key.
+		std::size_t find_many(const key_type* first, const key_type* last, size_type* indices) const
+		{
+			const size_type missing = max_size();
+			return _find_many(first, last, [indices, missing](std::size_t j, std::size_t i, bool found)
+			{
+				indices[j] = found ? static_cast<size_type>(i) : missing;
+			});
+		}
+		
+		
+		// Looks up every key in [first, last) and increments counts[i] for
+		// each key found at index i. counts must have room for size()
+		// counters. Returns the number of keys found.
+		template<typename counter_type>
+		std::size_t count_many(const key_type* first, const key_type* last, counter_type* counts) const
+		{
+			return _find_many(first, last, [counts](std::size_t, std::size_t i, bool found)
+			{
+				if (found)
+				{
+					++counts[i];
+				}
+			});
+		}
+		
+		
+		const_iterator begin() const
+		{
+			return empty() ? end() : const_iterator(this, 0);
+		}
+		
+		
+		const_iterator end() const
+		{
+			return const_iterator(this, max_size());
+		}
+		
+		
+		iterator begin()
+		{
+			return empty() ? end() : iterator(this, 0);
+		}
+		
+		
+		iterator end()
+		{
+			return iterator(this, max_size());
+		}
+		
+		
+		const_iterator cbegin() const
+		{
+			return empty() ? end() : const_iterator(this, 0);
+		}
+		
+		
+		const_iterator cend() const
+		{
+			return const_iterator(this, max_size());
+		}
+		
+		
+	private:
+		
+		size_type _capacity;
+		size_type _size;
+		key_type* _keys;
+		mapped_type* _values;
+		
+		
+		search& _search()
+		{
+			return *this;
+		}
+		
+		
+		const search& _search() const
+		{
+			return *this;
+		}
+		
+		
+		// Moves the item at index from to the unconstructed slot at index to.
+		void _move(size_type from, size_type to)
+		{
+			detail::relocate(_keys + from, 1, _keys + to);
+			detail::relocate(_values + from, 1, _values + to);
+			_search().moved(from, to);
+		}
+		
+		
+		// Moves size items at index from to index to, in one go if they are
+		// trivially relocatable. The search policy is told about each item in
+		// the order in which they would be moved one at a time.
+		void _shift(size_type from, size_type size, size_type to)
+		{
+			detail::relocate(_keys + from, size, _keys + to);
+			detail::relocate(_values + from, size, _values + to);
+			
+			for (size_type k = 0; k < size; ++k)
+			{
+				const size_type i = to < from ? k : size - 1 - k;
+				_search().moved(from + i, to + i);
+			}
+		}
+		
+		
+		// Constructs a new item where the search policy wants it, and returns
+		// its index. The map must not be full.
+		template<typename key_arg, typename ... Args>
+		size_type _insert(key_arg&& key, Args&& ... value_args)
+		{
+			const size_type i = static_cast<size_type>(_search().position(_keys, _size, key));
+			
+			// Shift the following items up to make room.
+			_shift(i, _size - i, i + 1);
+			
+			// If a constructor throws, the following items are shifted back
+			// so that the map is as it was.
+			try
+			{
+				new (&_keys[i]) key_type(std::forward<key_arg>(key));
+			}
+			catch (...)
+			{
+				_shift(i + 1, _size - i, i);
+				throw;
+			}
+			
+			try
+			{
+				new (&_values[i]) mapped_type(std::forward<Args>(value_args) ...);
+			}
+			catch (...)
+			{
+				detail::destroy(_keys + i, 1);
+				_shift(i + 1, _size - i, i);
+				throw;
+			}
+			
+			++_size;
+			_search().inserted(_keys, i);
+			return i;
+		}
+		
+		
+		const_iterator _find(const key_type& key) const
+		{
+			const size_type n = size();
+			const std::size_t i = _search().find(_keys, n, max_size(), key);
+			return i < n ? const_iterator(this, _promote(static_cast<size_type>(i))) : cend();
+		}
+		
+		
+		// Moves the item at index i to where the search policy wants it, and
+		// returns its new index. The order of the items is not part of the
+		// map's contents, hence this is const.
+		size_type _promote(size_type i) const
+		{
+			const size_type to = static_cast<size_type>(_search().promote(i));
+			
+			if (to < i)
+			{
+				std::rotate(_keys + to, _keys + i, _keys + i + 1);
+				std::rotate(_values + to, _values + i, _values + i + 1);
+			}
+			
+			return to;
+		}
+		
+		
+		// Invokes fn(j, i, found) for the j:th key in [first, last), where i
+		// is its index.
+		template<typename fn_type>
+		std::size_t _find_many(const key_type* first, const key_type* last, fn_type fn) const
+		{
+			const size_type n = size();
+			std::uint32_t batch[detail::batch_size];
+			std::size_t found = 0;
+			
+			for (std::size_t j = 0; first + j < last; j += detail::batch_size)
+			{
+				const std::size_t count = std::min<std::size_t>(last - first - j, detail::batch_size);
+				_search().find_many(_keys, n, max_size(), first + j, count, batch);
+				
+				for (std::size_t k = 0; k < count; ++k)
+				{
+					const bool hit = batch[k] < n;
+					found += hit;
+					fn(j + k, batch[k], hit);
+				}
+			}
+			
+			return found;
+		}
+		
+		
+	};
+	
+	
+	namespace detail
+	{
+		
+		
+		// Uninitialized storage for size objects, which are constructed and
+		// destroyed by a nanomap as items are inserted and erased.
+		template<typename value_type, std::size_t size>
+		class raw_array
+		{
+		public:
+			
+			value_type* data()
+			{
+				return reinterpret_cast<value_type*>(_storage);
+			}
+			
+			
+			const value_type* data() const
+			{
+				return reinterpret_cast<const value_type*>(_storage);
+			}
+			
+			
+		private:
+			
+			typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type _storage[size > 0 ? size : 1];
+			
+			
+		};
+		
+		
+		template<typename value_type>
+		inline void copy_construct(const value_type* from, std::size_t size, value_type* to, std::true_type)
+		{
+			if (size > 0)
+			{
+				std::memcpy(static_cast<void*>(to), from, size * sizeof(value_type));
+			}
+		}
+		
+		
+		template<typename value_type>
+		inline void copy_construct(const value_type* from, std::size_t size, value_type* to, std::false_type)
+		{
+			for (std::size_t i = 0; i < size; ++i)
+			{
+				new (&to[i]) value_type(from[i]);
+			}
+		}
+		
+		
+		// Copy constructs size objects in the uninitialized slots at to, with
+		// a single memcpy() if value_type is trivially copyable.
+		template<typename value_type>
+		inline void copy_construct(const value_type* from, std::size_t size, value_type* to)
+		{
+			copy_construct(from, size, to, std::is_trivially_copyable<value_type>());
+		}
+		
+		
+	}
+	
+	
+	template<typename key_type, typename mapped_type, std::size_t _capacity, typename key_equal = std::equal_to<key_type>, typename search = linear_search<key_type, key_equal>, typename _size_type = std::uint16_t>
+	class nanomap_factory
+	{
+	public:
+		
+		typedef nanomap<key_type, mapped_type, key_equal, search, _size_type> map_type;
+		typedef typename map_type::size_type size_type;
+		typedef typename map_type::column_type column_type;
+		
+		
+		static_assert(_capacity <= std::numeric_limits<size_type>::max(), "The capacity does not fit in size_type");
+		
+		
+		// The slots are left unconstructed until items are inserted.
+		nanomap_factory() : _map(_keys.data(), _values.data(), _column, _capacity)
+		{
+		}
+		
+		
+		// Only the items in the map are copied, with memcpy() if they are
+		// trivially copyable. The map is initialized with its size after they
+		// have been, so that the search policy sees them.
+		nanomap_factory(const nanomap_factory& f) : _map(_keys.data(), _values.data(), _column, _capacity)
+		{
+			const size_type n = f._map.size();
+			detail::copy_construct(f._keys.data(), n, _keys.data());
+			detail::copy_construct(f._values.data(), n, _values.data());
+			_map.init(_keys.data(), _values.data(), _column, _capacity, n);
+		}
+		
+		
+		// The items are relocated, with memcpy() if they are trivially
+		// relocatable, which leaves f empty.
+		nanomap_factory(nanomap_factory&& f) : _map(_keys.data(), _values.data(), _column, _capacity)
+		{
+			const size_type n = f._map.size();
+			detail::relocate(f._keys.data(), n, _keys.data());
+			detail::relocate(f._values.data(), n, _values.data());
+			_map.init(_keys.data(), _values.data(), _column, _capacity, n);
+			f._map.init(f._keys.data(), f._values.data(), f._column, _capacity, 0);
+		}
+		
+		
+		constexpr size_type capacity() const
+		{
+			return _capacity;
+		}
+		
+		
+		map_type& get()
+		{
+			return _map;
+		}
+		
+		
+		const map_type& get() const
+		{
+			return _map;
+		}
+		
+		
+	private:
+		
+		// The map is declared first so that it is destroyed last, after it
+		// has destroyed the items.
+		map_type _map;
+		detail::raw_array<key_type, _capacity + search::extra_slots> _keys;
+		detail::raw_array<mapped_type, _capacity> _values;
+		column_type _column[detail::has_column<search>::value ? _capacity : 1];
+		
+		
+	};
+	
+	
+	namespace detail
+	{
+		
+		
+		template<typename key_type, typename mapped_type, std::size_t key_slots, std::size_t value_slots>
+		struct static_storage
+		{
+			raw_array<key_type, key_slots> _key_storage;
+			raw_array<mapped_type, value_slots> _value_storage;
+		};
+		
+		
+	}
+	
+	
+	// A nanomap that owns its key and value arrays, and whose capacity is
+	// known at compile time. Lookups use unrolled_search, so for small
+	// capacities find() compiles to straight-line code with no loop. Unlike
+	// nanomap, static_nanomap can be copied and moved.
+	template<typename key_type, typename mapped_type, std::uint16_t _capacity, typename key_equal = std::equal_to<key_type>>
+	class static_nanomap :
+		private detail::static_storage<key_type, mapped_type, _capacity + unrolled_search<key_type, _capacity, key_equal>::extra_slots, _capacity>,
+		public nanomap<key_type, mapped_type, key_equal, unrolled_search<key_type, _capacity, key_equal>>
+	{
+	public:
+		
+		typedef nanomap<key_type, mapped_type, key_equal, unrolled_search<key_type, _capacity, key_equal>> map_type;
+		typedef typename map_type::size_type size_type;
+		
+		
+		static_nanomap() : map_type(this->_key_storage.data(), this->_value_storage.data(), _capacity)
+		{
+		}
+		
+		
+		static_nanomap(const static_nanomap& m) : map_type(this->_key_storage.data(), this->_value_storage.data(), _capacity)
+		{
+			_copy_from(m);
+		}
+		
+		
+		static_nanomap(static_nanomap&& m) : map_type(this->_key_storage.data(), this->_value_storage.data(), _capacity)
+		{
+			_move_from(m);
+		}
+		
+		
+		static_nanomap& operator=(const static_nanomap& m)
+		{
+			if (this != &m)
+			{
+				this->clear();
+				_copy_from(m);
+			}
+			
+			return *this;
+		}
+		
+		
+		static_nanomap& operator=(static_nanomap&& m)
+		{
+			if (this != &m)
+			{
+				this->clear();
+				_move_from(m);
+			}
+			
+			return *this;
+		}
+		
+		
+		constexpr size_type capacity() const
+		{
+			return _capacity;
+		}
+		
+		
+	private:
+		
+		// Copies the items of m into this empty map, with memcpy() if they
+		// are trivially copyable.
+		void _copy_from(const static_nanomap& m)
+		{
+			detail::copy_construct(m._key_storage.data(), m.size(), this->_key_storage.data());
+			detail::copy_construct(m._value_storage.data(), m.size(), this->_value_storage.data());
+			this->init(this->_key_storage.data(), this->_value_storage.data(), _capacity, m.size());
+		}
+		
+		
+		// Relocates the items of m into this empty map, which leaves m empty.
+		void _move_from(static_nanomap& m)
+		{
+			detail::relocate(m._key_storage.data(), m.size(), this->_key_storage.data());
+			detail::relocate(m._value_storage.data(), m.size(), this->_value_storage.data());
+			this->init(this->_key_storage.data(), this->_value_storage.data(), _capacity, m.size());
+			m.init(m._key_storage.data(), m._value_storage.data(), _capacity, 0);
+		}
+		
+		
+	};
+	
+	
+	template<typename key_type, typename mapped_type, std::uint16_t _capacity, typename key_equal> class small_nanomap;
+	
+	
+	template<bool is_const, typename key_type, typename mapped_type, std::uint16_t _capacity, typename key_equal>
+	class small_nanomap_iterator
+	{
+	public:
+		
+		typedef small_nanomap<key_type, mapped_type, _capacity, key_equal> map_type;
+		typedef typename map_type::size_type size_type;
+		typedef typename std::conditional<is_const, const map_type, map_type>::type owner_type;
+		typedef typename std::conditional<is_const, const mapped_type, mapped_type>::type ref;
+		typedef typename std::pair<const key_type&, ref&> value_type;
+		friend map_type;
+		friend class small_nanomap_iterator<!is_const, key_type, mapped_type, _capacity, key_equal>;
+		
+		
+		small_nanomap_iterator(owner_type* map, size_type index) : _map(map), _index(index)
+		{
+		}
+		
+		
+		small_nanomap_iterator() : small_nanomap_iterator(nullptr, 0)
+		{
+		}
+		
+		
+		// Note: this allows const_iterator(const iterator&).
+		template<bool other, typename = typename std::enable_if<is_const || !other>::type>
+		small_nanomap_iterator(const small_nanomap_iterator<other, key_type, mapped_type, _capacity, key_equal>& it) : _map(it._map), _index(it._index)
+		{
+		}
+		
+		
+		small_nanomap_iterator& operator++()
+		{
+			if (++_index >= _map->size())
+			{
+				_index = _capacity;
+			}
+			
+			return *this;
+		}
+		
+		
+		small_nanomap_iterator operator++(int)
+		{
+			small_nanomap_iterator tmp(*this);
+			operator++();
+			return tmp;
+		}
+		
+		
+		template<bool other>
+		bool operator==(const small_nanomap_iterator<other, key_type, mapped_type, _capacity, key_equal>& rhs) const
+		{
+			return _map != nullptr && _map == rhs._map && _index == rhs._index;
+		}
+		
+		
+		template<bool other>
+		bool operator!=(const small_nanomap_iterator<other, key_type, mapped_type, _capacity, key_equal>& rhs) const
+		{
+			return !operator==(rhs);
+		}
+		
+		
+		value_type operator*() const
+		{
+			return value_type(key(), value());
+		}
+		
+		
+		const key_type& key() const
+		{
+			return _map->_keys.data()[_index];
+		}
+		
+		
+		ref& value() const
+		{
+			return _map->_values.data()[_index];
+		}
+		
+		
+	private:
+		
+		owner_type* _map;
+		size_type _index;
+		
+	};
+	
+	
+	// A map that holds its keys and values inline, with no pointers and a
+	// one or two byte header. It is searched like static_nanomap, but is a
+	// plain value: it can be copied, moved and stored in a std::vector, and
+	// each map is a single block of memory. Copies and moves touch only the
+	// items in the map. Like nanomap, erase() moves the last item into the
+	// erased slot, which invalidates iterators to it.
+	template<typename key_type, typename mapped_type, std::uint16_t _capacity, typename key_equal = std::equal_to<key_type>>
+	class small_nanomap
+	{
+	public:
+		
+		typedef typename std::conditional<(_capacity < 0xff), std::uint8_t, std::uint16_t>::type size_type;
+		typedef mapped_type& reference;
+		typedef const mapped_type& const_reference;
+		typedef std::pair<const key_type, mapped_type> value_type;
+		typedef small_nanomap_iterator<false, key_type, mapped_type, _capacity, key_equal> iterator;
+		typedef small_nanomap_iterator<true, key_type, mapped_type, _capacity, key_equal> const_iterator;
+		typedef unrolled_search<key_type, _capacity, key_equal> search;
+		friend iterator;
+		friend const_iterator;
+		
+		
+		static_assert(_capacity < 0xffff, "The capacity does not fit in size_type");
+		
+		
+		small_nanomap() : _size(0)
+		{
+		}
+		
+		
+		small_nanomap(const small_nanomap& m) : _size(m._size)
+		{
+			detail::copy_construct(m._keys.data(), _size, _keys.data());
+			detail::copy_construct(m._values.data(), _size, _values.data());
+		}
+		
+		
+		small_nanomap(small_nanomap&& m) noexcept(std::is_nothrow_move_constructible<key_type>::value && std::is_nothrow_move_constructible<mapped_type>::value) :
+			_size(m._size)
+		{
+			detail::relocate(m._keys.data(), _size, _keys.data());
+			detail::relocate(m._values.data(), _size, _values.data());
+			m._size = 0;
+		}
+		
+		
+		~small_nanomap()
+		{
+			clear();
+		}
+		
+		
+		small_nanomap& operator=(const small_nanomap& m)
+		{
+			if (this != &m)
+			{
+				clear();
+				detail::copy_construct(m._keys.data(), m._size, _keys.data());
+				detail::copy_construct(m._values.data(), m._size, _values.data());
+				_size = m._size;
+			}
+			
+			return *this;
+		}
+		
+		
+		small_nanomap& operator=(small_nanomap&& m)
+		{
+			if (this != &m)
+			{
+				clear();
+				detail::relocate(m._keys.data(), m._size, _keys.data());
+				detail::relocate(m._values.data(), m._size, _values.data());
+				_size = m._size;
+				m._size = 0;
+			}
+			
+			return *this;
+		}
+		
+		
+		bool empty() const
+		{
+			return _size == 0;
+		}
+		
+		
+		size_type size() const
+		{
+			return _size;
+		}
+		
+		
+		constexpr size_type max_size() const
+		{
+			return _capacity;
+		}
+		
+		
+		constexpr size_type capacity() const
+		{
+			return _capacity;
+		}
+		
+		
+		void clear()
+		{
+			detail::destroy(_keys.data(), _size);
+			detail::destroy(_values.data(), _size);
+			_size = 0;
+		}
+		
+		
+		// Unlike nanomap::insert(), does nothing if the key is already in the
+		// map, and returns an iterator to it.
+		std::pair<iterator, bool> insert(const value_type& item)
+		{
+			return emplace(item.first, item.second);
+		}
+		
+		
+		template<typename ... Args>
+		std::pair<iterator, bool> emplace(const key_type& key, Args&& ... value_args)
+		{
+			const size_type i = _find(key);
+			
+			if (i < _size || _size >= _capacity)
+			{
+				return std::pair<iterator, bool>(i < _size ? iterator(this, i) : end(), false);
+			}
+			
+			return std::pair<iterator, bool>(iterator(this, _insert(key, std::forward<Args>(value_args) ...)), true);
+		}
+		
+		
+		iterator erase(const_iterator it)
+		{
+			if (it._index >= _size)
+			{
+				std::abort();
+			}
+			
+			const size_type i = it._index;
+			detail::destroy(_keys.data() + i, 1);
+			detail::destroy(_values.data() + i, 1);
+			
+			if (i < --_size)
+			{
+				detail::relocate(_keys.data() + _size, 1, _keys.data() + i);
+				detail::relocate(_values.data() + _size, 1, _values.data() + i);
+				return iterator(this, i);
+			}
+			
+			return end();
+		}
+		
+		
+		size_type erase(const key_type& key)
+		{
+			const size_type i = _find(key);
+			
+			if (i < _size)
+			{
+				erase(const_iterator(this, i));
+				return 1;
+			}
+			
+			return 0;
+		}
+		
+		
+		mapped_type& operator[](const key_type& key)
+		{
+			size_type i = _find(key);
+			
+			if (i == _size)
+			{
+				if (_size >= _capacity)
+				{
+					throw std::overflow_error("small_nanomap is full");
+				}
+				
+				i = _insert(key);
+			}
+			
+			return _values.data()[i];
+		}
+		
+		
+		mapped_type& at(const key_type& key)
+		{
+			const size_type i = _find(key);
+			
+			if (i == _size)
+			{
+				throw std::out_of_range("item not found");
+			}
+			
+			return _values.data()[i];
+		}
+		
+		
+		const mapped_type& at(const key_type& key) const
+		{
+			return const_cast<small_nanomap*>(this)->at(key);
+		}
+		
+		
+		size_type count(const key_type& key) const
+		{
+			return _find(key) < _size;
+		}
+		
+		
+		const_iterator find(const key_type& key) const
+		{
+			const size_type i = _find(key);
+			return i < _size ? const_iterator(this, i) : end();
+		}
+		
+		
+		iterator find(const key_type& key)
+		{
+			const size_type i = _find(key);
+			return i < _size ? iterator(this, i) : end();
+		}
+		
+		
+		const_iterator begin() const
+		{
+			return empty() ? end() : const_iterator(this, 0);
+		}
+		
+		
+		const_iterator end() const
+		{
+			return const_iterator(this, _capacity);
+		}
+		
+		
+		iterator begin()
+		{
+			return empty() ? end() : iterator(this, 0);
+		}
+		
+		
+		iterator end()
+		{
+			return iterator(this, _capacity);
+		}
+		
+		
+		const_iterator cbegin() const
+		{
+			return begin();
+		}
+		
+		
+		const_iterator cend() const
+		{
+			return end();
+		}
+		
+		
+	private:
+		
+		detail::raw_array<key_type, _capacity + search::extra_slots> _keys;
+		detail::raw_array<mapped_type, _capacity> _values;
+		size_type _size;
+		
+		
+		// Returns the index of key, or size() if not found.
+		size_type _find(const key_type& key) const
+		{
+			return static_cast<size_type>(search().find(_keys.data(), _size, _capacity, key));
+		}
+		
+		
+		template<typename ... Args>
+		size_type _insert(const key_type& key, Args&& ... value_args)
+		{
+			new (&_keys.data()[_size]) key_type(key);
+			new (&_values.data()[_size]) mapped_type(std::forward<Args>(value_args) ...);
+			return _size++;
+		}
+		
+		
+	};
+	
+	
+	// small_nanomap holds no pointers to itself, so it can be moved with
+	// memcpy() if its keys and values can.
+	template<typename key_type, typename mapped_type, std::uint16_t _capacity, typename key_equal>
+	struct is_trivially_relocatable<small_nanomap<key_type, mapped_type, _capacity, key_equal>> :
+		std::integral_constant<bool, is_trivially_relocatable<key_type>::value && is_trivially_relocatable<mapped_type>::value>
+	{
+	};
+	
+	
+	namespace detail
+	{
+		
+		
+		template<std::size_t ... I>
+		struct index_sequence
+		{
+		};
+		
+		
+		template<typename, typename>
+		struct concat_sequences;
+		
+		
+		template<std::size_t ... I, std::size_t ... J>
+		struct concat_sequences<index_sequence<I ...>, index_sequence<J ...>>
+		{
+			typedef index_sequence<I ..., (sizeof...(I) + J) ...> type;
+		};
+		
+		
+		// index_sequence<0, 1, ..., n - 1>, in logarithmic template depth.
+		template<std::size_t n>
+		struct make_index_sequence
+		{
+			typedef typename concat_sequences<typename make_index_sequence<n / 2>::type, typename make_index_sequence<n - n / 2>::type>::type type;
+		};
+		
+		
+		template<>
+		struct make_index_sequence<0>
+		{
+			typedef index_sequence<> type;
+		};
+		
+		
+		template<>
+		struct make_index_sequence<1>
+		{
+			typedef index_sequence<0> type;
+		};
+		
+		
+		// std::equal_to is not constexpr before C++14, but it is defined to
+		// be operator==.
+		template<typename key_type, typename key_equal>
+		struct constexpr_equal
+		{
+			static constexpr bool apply(const key_type& lhs, const key_type& rhs)
+			{
+				return key_equal()(lhs, rhs);
+			}
+		};
+		
+		
+		template<typename key_type>
+		struct constexpr_equal<key_type, std::equal_to<key_type>>
+		{
+			static constexpr bool apply(const key_type& lhs, const key_type& rhs)
+			{
+				return lhs == rhs;
+			}
+		};
+		
+		
+	}
+	
+	
+	// A read-only map whose contents are fixed when it is constructed, and
+	// which can be constructed at compile time:
+	//
+	//     constexpr gdc::frozen_nanomap<int, char, 3> table({ { 1, 'a' }, { 2, 'b' }, { 3, 'c' } });
+	//     static_assert(table.at(2) == 'b', "");
+	//
+	// A constexpr frozen_nanomap is placed in read-only data, needs no
+	// initialization at startup, and lookups of constant keys are folded by
+	// the compiler. This works in C++11; keys and values must be literal
+	// types, and key_equal must be std::equal_to or have a constexpr call
+	// operator. Like nanomap, keys and values are stored in separate arrays.
+	// Duplicate keys are rejected: in a constant expression they are a
+	// compile-time error, and at run time they throw std::invalid_argument.
+	// The check compares every pair of keys; with the compilers' default
+	// limits, a table built in a constant expression can hold several
+	// hundred keys.
+	template<typename key_type, typename mapped_type, std::size_t _size, typename key_equal = std::equal_to<key_type>>
+	class frozen_nanomap
+	{
+	public:
+		
+		typedef std::size_t size_type;
+		typedef std::pair<key_type, mapped_type> value_type;
+		
+		
+		static_assert(_size > 0, "frozen_nanomap needs at least one item");
+		
+		
+		constexpr frozen_nanomap(const value_type (&items)[_size]) :
+			frozen_nanomap(items, typename detail::make_index_sequence<_size>::type())
+		{
+		}
+		
+		
+		constexpr bool empty() const
+		{
+			return _size == 0;
+		}
+		
+		
+		constexpr size_type size() const
+		{
+			return _size;
+		}
+		
+		
+		// Returns the index of key, or size() if not found. Usable in
+		// constant expressions.
+		constexpr size_type find(const key_type& key) const
+		{
+			return _find(key, 0, _size);
+		}
+		
+		
+		// Same as find(), but not usable in constant expressions. Scans the
+		// keys with SIMD instructions, like nanomap. Use this for keys known
+		// only at run time.
+		size_type scan(const key_type& key) const
+		{
+			return detail::linear_find<key_type, key_equal>(_keys, _size, _size, key);
+		}
+		
+		
+		constexpr bool contains(const key_type& key) const
+		{
+			return find(key) != _size;
+		}
+		
+		
+		// Throws std::out_of_range if key is not found. In a constant
+		// expression, a missing key is a compile-time error.
+		constexpr const mapped_type& at(const key_type& key) const
+		{
+			return _at(find(key));
+		}
+		
+		
+		constexpr const key_type& key(size_type i) const
+		{
+			return _keys[i];
+		}
+		
+		
+		constexpr const mapped_type& value(size_type i) const
+		{
+			return _values[i];
+		}
+		
+		
+	private:
+		
+		key_type _keys[_size];
+		mapped_type _values[_size];
+		
+		
+		template<std::size_t ... I>
+		constexpr frozen_nanomap(const value_type (&items)[_size], detail::index_sequence<I ...>) :
+			_keys{ _unique(items, I) ... }, _values{ items[I].second ... }
+		{
+		}
+		
+		
+		// Returns the key of items[i], which must not occur after it.
+		static constexpr const key_type& _unique(const value_type (&items)[_size], size_type i)
+		{
+			return _count(items, items[i].first, i + 1, _size - i - 1) == 0 ? items[i].first : throw std::invalid_argument("duplicate key");
+		}
+		
+		
+		// The number of keys equal to key in items[first, first + count).
+		// A C++11 constexpr function cannot loop, and halving the range
+		// keeps the recursion depth logarithmic.
+		static constexpr size_type _count(const value_type (&items)[_size], const key_type& key, size_type first, size_type count)
+		{
+			return count == 0 ? 0 : count == 1 ?
+				(detail::constexpr_equal<key_type, key_equal>::apply(items[first].first, key) ? 1 : 0) :
+				_count(items, key, first, count / 2) + _count(items, key, first + count / 2, count - count / 2);
+		}
+		
+		
+		// Returns the index of key in [first, first + count), or _size if
+		// not found. Halves the range like _count().
+		constexpr size_type _find(const key_type& key, size_type first, size_type count) const
+		{
+			return count == 1 ?
+				(detail::constexpr_equal<key_type, key_equal>::apply(_keys[first], key) ? first : _size) :
+				_find_next(_find(key, first, count / 2), key, first + count / 2, count - count / 2);
+		}
+		
+		
+		// Returns found, unless it is _size, in which case key is looked up
+		// in [first, first + count).
+		constexpr size_type _find_next(size_type found, const key_type& key, size_type first, size_type count) const
+		{
+			return found != _size ? found : _find(key, first, count);
+		}
+		
+		
+		constexpr const mapped_type& _at(size_type i) const
+		{
+			return i != _size ? _values[i] : throw std::out_of_range("item not found");
+		}
+		
+		
+	};
+	
+	
+	namespace detail
+	{
+		
+		
+		// MurmurHash3's 64-bit finalizer.
+		inline std::uint64_t fmix(std::uint64_t x)
+		{
+			x ^= x >> 33;
+			x *= 0xff51afd7ed558ccdull;
+			x ^= x >> 33;
+			x *= 0xc4ceb9fe1a85ec53ull;
+			x ^= x >> 33;
+			return x;
+		}
+		
+		
+		// Maps the high 32 bits of x to [0, n) without a division.
+		inline std::size_t reduce(std::uint64_t x, std::size_t n)
+		{
+			return static_cast<std::size_t>(((x >> 32) * n) >> 32);
+		}
+		
+		
+	}
+	
+	
+	// An immutable index over the keys of a nanomap, built with a minimal
+	// perfect hash: every key hashes to a slot of its own, so a lookup costs
+	// two hash mixes, two array reads and a single key comparison, whatever
+	// the size of the map. Keys are first hashed into buckets, and each
+	// bucket gets a seed that sends its keys to free slots ("hash and
+	// displace"). The index refers to the keys and values in the nanomap,
+	// which must not be modified while the index is in use. Building the
+	// index allocates memory and takes time roughly proportional to the
+	// size of the map. See freeze().
+	template<typename key_type, typename mapped_type, typename key_equal = std::equal_to<key_type>, typename search = linear_search<key_type, key_equal>, typename hash = std::hash<key_type>, typename _size_type = std::uint16_t>
+	class perfect_nanomap
+	{
+	public:
+		
+		typedef nanomap<key_type, mapped_type, key_equal, search, _size_type> map_type;
+		typedef typename map_type::size_type size_type;
+		typedef typename map_type::iterator iterator;
+		typedef typename map_type::const_iterator const_iterator;
+		
+		
+		// Throws std::invalid_argument if two keys in map have the same hash.
+		explicit perfect_nanomap(map_type& map) : _map(&map)
+		{
+			std::vector<std::size_t> hashes(map.size());
+			
+			for (size_type i = 0; i < map.size(); ++i)
+			{
+				hashes[i] = hash()(const_iterator(&map, i).key());
+			}
+			
+			std::vector<std::size_t> sorted(hashes);
+			std::sort(sorted.begin(), sorted.end());
+			
+			if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+			{
+				throw std::invalid_argument("keys with equal hashes");
+			}
+			
+			for (std::size_t buckets = (hashes.size() + 3) / 4 + 1; !_build(hashes, buckets); buckets *= 2)
+			{
+			}
+		}
+		
+		
+		size_type size() const
+		{
+			return static_cast<size_type>(_slots.size());
+		}
+		
+		
+		const_iterator find(const key_type& key) const
+		{
+			return find(key, hash()(key));
+		}
+		
+		
+		iterator find(const key_type& key)
+		{
+			return find(key, hash()(key));
+		}
+		
+		
+		// h must be hash()(key).
+		const_iterator find(const key_type& key, std::size_t h) const
+		{
+			return const_iterator(_map, _find(key, h));
+		}
+		
+		
+		iterator find(const key_type& key, std::size_t h)
+		{
+			return iterator(_map, _find(key, h));
+		}
+		
+		
+		mapped_type& at(const key_type& key)
+		{
+			iterator it = find(key);
+			
+			if (it == end())
+			{
+				throw std::out_of_range("item not found");
+			}
+			
+			return it.value();
+		}
+		
+		
+		const_iterator end() const
+		{
+			return _map->cend();
+		}
+		
+		
+		iterator end()
+		{
+			return _map->end();
+		}
+		
+		
+		map_type& map()
+		{
+			return *_map;
+		}
+		
+		
+	private:
+		
+		map_type* _map;
+		std::vector<std::uint32_t> _seeds;
+		std::vector<size_type> _slots;
+		
+		
+		static std::size_t _bucket(std::size_t h, std::size_t buckets)
+		{
+			return detail::reduce(detail::mix(h), buckets);
+		}
+		
+		
+		std::size_t _slot(std::size_t h, std::uint32_t seed) const
+		{
+			return detail::reduce(detail::fmix(std::uint64_t(h) ^ detail::mix(seed)), _slots.size());
+		}
+		
+		
+		size_type _find(const key_type& key, std::size_t h) const
+		{
+			if (_slots.empty())
+			{
+				return _map->max_size();
+			}
+			
+			const size_type i = _slots[_slot(h, _seeds[_bucket(h, _seeds.size())])];
+			return key_equal()(const_iterator(_map, i).key(), key) ? i : _map->max_size();
+		}
+		
+		
+		// Places the largest buckets first, while the table is still empty.
+		// Returns false if some bucket cannot be placed, in which case the
+		// caller tries again with more, smaller buckets.
+		bool _build(const std::vector<std::size_t>& hashes, std::size_t buckets)
+		{
+			const std::size_t n = hashes.size();
+			const size_type none = _map->max_size();
+			std::vector<std::vector<size_type>> members(buckets);
+			std::vector<std::size_t> order(buckets);
+			std::vector<std::size_t> candidate;
+			std::vector<bool> taken(n);
+			_seeds.assign(buckets, 0);
+			_slots.assign(n, none);
+			
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				members[_bucket(hashes[i], buckets)].push_back(static_cast<size_type>(i));
+			}
+			
+			for (std::size_t b = 0; b < buckets; ++b)
+			{
+				order[b] = b;
+			}
+			
+			std::sort(order.begin(), order.end(), [&members](std::size_t lhs, std::size_t rhs)
+			{
+				return members[lhs].size() > members[rhs].size();
+			});
+			
+			for (std::size_t b : order)
+			{
+				std::uint32_t seed = 0;
+				
+				for (; seed < max_seed; ++seed)
+				{
+					candidate.clear();
+					
+					for (size_type i : members[b])
+					{
+						const std::size_t slot = _slot(hashes[i], seed);
+						
+						if (taken[slot] || std::find(candidate.begin(), candidate.end(), slot) != candidate.end())
+						{
+							break;
+						}
+						
+						candidate.push_back(slot);
+					}
+					
+					if (candidate.size() == members[b].size())
+					{
+						break;
+					}
+				}
+				
+				if (seed == max_seed)
+				{
+					return false;
+				}
+				
+				_seeds[b] = seed;
+				
+				for (std::size_t k = 0; k < candidate.size(); ++k)
+				{
+					taken[candidate[k]] = true;
+					_slots[candidate[k]] = members[b][k];
+				}
+			}
+			
+			return true;
+		}
+		
+		
+		static constexpr std::uint32_t max_seed = 1u << 20;
+		
+		
+	};
+	
+	
+	// Builds a perfect_nanomap over the current keys of map. For maps that
+	// are filled once and then read many times.
+	template<typename hash = void, typename key_type, typename mapped_type, typename key_equal, typename search, typename size_type>
+	perfect_nanomap<key_type, mapped_type, key_equal, search, typename std::conditional<std::is_void<hash>::value, std::hash<key_type>, hash>::type, size_type>
+	freeze(nanomap<key_type, mapped_type, key_equal, search, size_type>& map)
+	{
+		return perfect_nanomap<key_type, mapped_type, key_equal, search, typename std::conditional<std::is_void<hash>::value, std::hash<key_type>, hash>::type, size_type>(map);
+	}
+	
+	
 }
 
 
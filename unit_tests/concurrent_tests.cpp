@@ -0,0 +1,720 @@
+//
+// Copyright (c) 2016 Dado Colussi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+#include <gdc/concurrent_nanomap.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+
+struct versioned
+{
+	std::uint64_t version;
+	std::uint64_t check;
+};
+
+
+SCENARIO("seqlock_nanomap", "[concurrent]")
+{
+	GIVEN("a seqlock_nanomap")
+	{
+		gdc::seqlock_nanomap<int, int, 16> that;
+		
+		THEN("writes are seen by reads")
+		{
+			int value = -1;
+			CHECK(!that.find(1, value));
+			CHECK(value == -1);
+			
+			CHECK(that.insert(1, 10));
+			CHECK(!that.insert(1, 11));
+			that.assign(2, 20);
+			that.assign(2, 21);
+			
+			CHECK(that.find(1, value));
+			CHECK(value == 10);
+			CHECK(that.find(2, value));
+			CHECK(value == 21);
+			CHECK(that.size() == 2);
+			
+			CHECK(that.erase(1));
+			CHECK(!that.erase(1));
+			CHECK(!that.contains(1));
+			CHECK(that.read([](const gdc::seqlock_nanomap<int, int, 16>::map_type& map) { return map.find(2).value(); }) == 21);
+			
+			that.clear();
+			CHECK(that.size() == 0);
+		}
+		
+		THEN("a full map rejects writes")
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				that.assign(i, i);
+			}
+			
+			CHECK(!that.insert(16, 16));
+			CHECK_THROWS_AS(that.assign(16, 16), std::overflow_error);
+			CHECK(that.size() == 16);
+		}
+	}
+	
+	GIVEN("a writer and several readers")
+	{
+		gdc::seqlock_nanomap<int, versioned, 16> that;
+		std::atomic<bool> done(false);
+		std::atomic<int> torn(0);
+		std::vector<std::thread> readers;
+		
+		for (int k = 0; k < 8; ++k)
+		{
+			that.assign(k, versioned{ 0, ~std::uint64_t(0) });
+		}
+		
+		for (int r = 0; r < 3; ++r)
+		{
+			readers.emplace_back([&]()
+			{
+				versioned v;
+				
+				while (!done.load())
+				{
+					for (int k = 0; k < 9; ++k)
+					{
+						if (that.find(k, v) && v.check != ~v.version)
+						{
+							++torn;
+						}
+					}
+				}
+			});
+		}
+		
+		for (std::uint64_t i = 1; i <= 20000; ++i)
+		{
+			that.assign(static_cast<int>(i % 8), versioned{ i, ~i });
+			
+			if (i % 2 == 0)
+			{
+				that.insert(8, versioned{ i, ~i });
+			}
+			else
+			{
+				that.erase(8);
+			}
+		}
+		
+		done = true;
+		
+		for (auto& reader : readers)
+		{
+			reader.join();
+		}
+		
+		THEN("no reader sees a torn value")
+		{
+			CHECK(torn == 0);
+			CHECK(that.size() == 9);
+		}
+	}
+}
+
+
+SCENARIO("snapshot_nanomap", "[concurrent]")
+{
+	typedef gdc::snapshot_nanomap<int, std::string, 16, 3> map_type;
+	
+	GIVEN("a snapshot_nanomap")
+	{
+		map_type that;
+		
+		THEN("a snapshot is not affected by later updates")
+		{
+			that.update([](map_type::map_type& map) { map[1] = "one"; });
+			auto before = that.read();
+			
+			CHECK(that.update([](map_type::map_type& map) { map[2] = "two"; return map.size(); }) == 2);
+			that.update([](map_type::map_type& map) { map[1] = "uno"; });
+			
+			auto after = that.read();
+			CHECK(before->size() == 1);
+			CHECK(before->find(1).value() == "one");
+			CHECK(after->size() == 2);
+			CHECK(after->find(1).value() == "uno");
+			CHECK((*after).find(2).value() == "two");
+		}
+		
+		THEN("an update that throws is not published")
+		{
+			that.update([](map_type::map_type& map) { map[1] = "one"; });
+			CHECK_THROWS_AS(that.update([](map_type::map_type& map) { map[2] = "two"; throw std::runtime_error("failed"); }), std::runtime_error);
+			CHECK(that.read()->size() == 1);
+		}
+	}
+	
+	GIVEN("a snapshot_nanomap with two buffers")
+	{
+		typedef gdc::snapshot_nanomap<int, int, 16> pair_type;
+		pair_type that;
+		
+		THEN("a held snapshot delays the next update until it is released")
+		{
+			that.update([](pair_type::map_type& map) { map[1] = 1; });
+			std::atomic<bool> updated(false);
+			std::thread writer;
+			
+			{
+				auto held = that.read();
+				
+				// The first update fills the spare buffer, the second waits.
+				writer = std::thread([&]()
+				{
+					that.update([](pair_type::map_type& map) { map[1] = 2; });
+					that.update([](pair_type::map_type& map) { map[1] = 3; });
+					updated = true;
+				});
+				
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				CHECK(!updated.load());
+				CHECK(held->find(1).value() == 1);
+			}
+			
+			writer.join();
+			CHECK(that.read()->find(1).value() == 3);
+		}
+	}
+	
+	GIVEN("a writer and several readers")
+	{
+		typedef gdc::snapshot_nanomap<int, std::uint64_t, 16, 3> counters_type;
+		counters_type that;
+		std::atomic<bool> done(false);
+		std::atomic<int> inconsistent(0);
+		std::vector<std::thread> readers;
+		
+		for (int r = 0; r < 3; ++r)
+		{
+			readers.emplace_back([&]()
+			{
+				while (!done.load())
+				{
+					auto snapshot = that.read();
+					
+					for (auto it = snapshot->cbegin(); it != snapshot->cend(); ++it)
+					{
+						if (it.value() != snapshot->cbegin().value())
+						{
+							++inconsistent;
+						}
+					}
+				}
+			});
+		}
+		
+		for (std::uint64_t i = 1; i <= 500; ++i)
+		{
+			that.update([i](counters_type::map_type& map)
+			{
+				for (int k = 0; k < 16; ++k)
+				{
+					map[k] = i;
+				}
+			});
+		}
+		
+		done = true;
+		
+		for (auto& reader : readers)
+		{
+			reader.join();
+		}
+		
+		THEN("every snapshot is consistent")
+		{
+			CHECK(inconsistent == 0);
+			CHECK(that.read()->find(5).value() == 500);
+		}
+	}
+}
+
+
+// Throws when constructed from a negative number.
+class picky
+{
+public:
+	
+	static int alive;
+	
+	
+	explicit picky(int value) : _value(value)
+	{
+		if (value < 0)
+		{
+			throw std::invalid_argument("negative");
+		}
+		
+		++alive;
+	}
+	
+	
+	~picky()
+	{
+		--alive;
+	}
+	
+	
+	int value() const
+	{
+		return _value;
+	}
+	
+	
+private:
+	
+	int _value;
+	
+};
+
+
+int picky::alive = 0;
+
+
+SCENARIO("append_only_nanomap", "[concurrent]")
+{
+	GIVEN("an append_only_nanomap")
+	{
+		gdc::append_only_nanomap<std::string, int, 4> that;
+		
+		THEN("the first value inserted for a key is kept")
+		{
+			auto a = that.insert("a", 1);
+			CHECK(a.second);
+			CHECK(*a.first == 1);
+			
+			auto b = that.emplace("a", 2);
+			CHECK(!b.second);
+			CHECK(b.first == a.first);
+			
+			CHECK(*that.find("a") == 1);
+			CHECK(that.find("b") == nullptr);
+			CHECK(that.size() == 1);
+		}
+		
+		THEN("a full map rejects new keys but finds old ones")
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				that.insert(std::to_string(i), i);
+			}
+			
+			CHECK(that.insert("4", 4).first == nullptr);
+			CHECK(that.insert("3", 5).first == that.find("3"));
+			CHECK(that.size() == 4);
+			
+			int sum = 0;
+			that.for_each([&sum](const std::string&, int value) { sum += value; });
+			CHECK(sum == 6);
+		}
+	}
+	
+	GIVEN("a value type whose constructor throws")
+	{
+		THEN("a failed insert leaves the map usable")
+		{
+			{
+				gdc::append_only_nanomap<std::string, picky, 4> that;
+				CHECK_THROWS_AS(that.emplace("a", -1), std::invalid_argument);
+				CHECK(that.find("a") == nullptr);
+				CHECK(that.emplace("a", 1).second);
+				CHECK(that.emplace("b", 2).second);
+				CHECK(that.find("a")->value() == 1);
+				CHECK(that.size() == 2);
+				CHECK(picky::alive == 2);
+			}
+			
+			CHECK(picky::alive == 0);
+		}
+	}
+	
+	GIVEN("several threads inserting overlapping keys")
+	{
+		gdc::append_only_nanomap<int, int, 300> that;
+		std::atomic<int> inserted(0);
+		std::vector<std::thread> writers;
+		
+		for (int t = 0; t < 4; ++t)
+		{
+			writers.emplace_back([&that, &inserted, t]()
+			{
+				for (int k = 0; k < 300; ++k)
+				{
+					auto result = that.insert((k * 7 + t) % 300, t);
+					
+					if (result.second)
+					{
+						++inserted;
+					}
+					
+					if (result.first == nullptr || that.find((k * 7 + t) % 300) != result.first)
+					{
+						--inserted;
+					}
+				}
+			});
+		}
+		
+		for (auto& writer : writers)
+		{
+			writer.join();
+		}
+		
+		THEN("each key is inserted exactly once")
+		{
+			CHECK(inserted == 300);
+			CHECK(that.size() == 300);
+			
+			int live = 0;
+			that.for_each([&live](int, int) { ++live; });
+			CHECK(live == 300);
+		}
+	}
+}
+
+
+SCENARIO("sharded_nanomap", "[concurrent]")
+{
+	GIVEN("a sharded_nanomap updated by several threads")
+	{
+		std::vector<int> keys;
+		
+		for (int k = 0; k < 100; ++k)
+		{
+			keys.push_back(k * 3);
+		}
+		
+		gdc::sharded_nanomap<int, std::uint32_t, 128> that(4, keys.begin(), keys.end());
+		std::vector<std::thread> threads;
+		
+		for (std::size_t t = 0; t < that.shards(); ++t)
+		{
+			threads.emplace_back([&that, t]()
+			{
+				auto& shard = that.shard(t);
+				
+				for (int i = 0; i < 10000; ++i)
+				{
+					auto it = shard.find(i % 400);
+					
+					if (it != shard.end())
+					{
+						++it.value();
+					}
+				}
+			});
+		}
+		
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		
+		THEN("reduce() sums the counts of all shards")
+		{
+			auto& sum = that.reduce();
+			CHECK(sum.size() == 100);
+			CHECK(sum.find(0).value() == 4 * 25);
+			CHECK(sum.find(297).value() == 4 * 25);
+			CHECK(sum.find(298) == sum.end());
+			
+			auto it = sum.cbegin();
+			
+			for (int k = 0; k < 100; ++k, ++it)
+			{
+				REQUIRE(it.key() == k * 3);
+			}
+		}
+		
+		THEN("reset() zeroes the counts")
+		{
+			that.reset();
+			CHECK(that.reduce().find(3).value() == 0);
+		}
+	}
+	
+	GIVEN("value types with and without SIMD addition")
+	{
+		const int keys[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33 };
+		
+		THEN("bytes wrap around")
+		{
+			gdc::sharded_nanomap<int, std::uint8_t, 40> that(3, std::begin(keys), std::end(keys));
+			
+			for (std::size_t t = 0; t < 3; ++t)
+			{
+				that.shard(t)[33] = 100;
+				that.shard(t)[1] = 1;
+			}
+			
+			CHECK(that.reduce().find(33).value() == 44);
+			CHECK(that.reduce().find(1).value() == 3);
+		}
+		
+		THEN("doubles are added")
+		{
+			gdc::sharded_nanomap<int, double, 40> that(2, std::begin(keys), std::end(keys));
+			that.shard(0)[30] = 0.5;
+			that.shard(1)[30] = 0.25;
+			CHECK(that.reduce().find(30).value() == 0.75);
+		}
+		
+		THEN("other types are added with operator+=")
+		{
+			gdc::sharded_nanomap<int, std::string, 40> that(2, std::begin(keys), std::end(keys));
+			that.shard(0)[31] = "a";
+			that.shard(1)[31] = "b";
+			CHECK(that.reduce().find(31).value() == "ab");
+		}
+	}
+}
+
+
+SCENARIO("parallel_find_each", "[concurrent]")
+{
+	GIVEN("a nanomap and a haystack")
+	{
+		gdc::nanomap_factory<int, int, 32> factory;
+		auto& that = factory.get();
+		std::vector<int> haystack(100000);
+		
+		for (int i = 0; i < 32; ++i)
+		{
+			that[i * 10] = i;
+		}
+		
+		for (std::size_t j = 0; j < haystack.size(); ++j)
+		{
+			haystack[j] = static_cast<int>((j * 7919) % 1000);
+		}
+		
+		WHEN("searching it on several threads")
+		{
+			const std::size_t threads = 4;
+			std::vector<std::vector<std::size_t>> counts(threads, std::vector<std::size_t>(that.size()));
+			std::vector<std::uint16_t> indices(haystack.size());
+			
+			const std::size_t found = gdc::parallel_find_each(that, haystack.data(), haystack.data() + haystack.size(), [&](std::size_t worker, std::size_t j, std::uint16_t index)
+			{
+				indices[j] = index;
+				
+				if (index != that.max_size())
+				{
+					++counts[worker][index];
+				}
+			}, threads);
+			
+			THEN("every key is reported once with its index")
+			{
+				std::vector<std::uint16_t> expected(haystack.size());
+				CHECK(found == that.find_many(haystack.data(), haystack.data() + haystack.size(), expected.data()));
+				CHECK(indices == expected);
+				
+				std::size_t total = 0;
+				
+				for (auto& worker : counts)
+				{
+					for (std::size_t count : worker)
+					{
+						total += count;
+					}
+				}
+				
+				CHECK(total == found);
+			}
+		}
+		
+		THEN("a single thread and an empty range work")
+		{
+			std::size_t calls = 0;
+			CHECK(gdc::parallel_find_each(that, haystack.data(), haystack.data(), [&calls](std::size_t, std::size_t, std::uint16_t) { ++calls; }, 4) == 0);
+			CHECK(gdc::parallel_find_each(that, haystack.data(), haystack.data() + 10, [&calls](std::size_t worker, std::size_t, std::uint16_t) { calls += worker + 1; }, 1) == 1);
+			CHECK(calls == 10);
+		}
+		
+		THEN("an exception on the calling thread joins the workers and propagates")
+		{
+			std::atomic<std::size_t> calls(0);
+			
+			CHECK_THROWS_AS(gdc::parallel_find_each(that, haystack.data(), haystack.data() + haystack.size(), [&calls](std::size_t worker, std::size_t, std::uint16_t)
+			{
+				++calls;
+				
+				if (worker == 0)
+				{
+					throw std::runtime_error("worker 0");
+				}
+			}, 4), std::runtime_error&);
+			
+			CHECK(calls.load() < haystack.size());
+		}
+	}
+}
+
+
+SCENARIO("atomic_nanomap", "[concurrent]")
+{
+	const std::string keys[] = { "get", "put", "delete", "get" };
+	
+	GIVEN("an atomic_nanomap")
+	{
+		gdc::atomic_nanomap<std::string, long, 8> that(std::begin(keys), std::end(keys), 5);
+		
+		THEN("values can be updated by key")
+		{
+			CHECK(that.size() == 3);
+			CHECK(that.fetch_add("get", 2) == 5);
+			CHECK(that.load("get") == 7);
+			
+			long expected = 6;
+			CHECK(!that.compare_exchange("put", expected, 9));
+			CHECK(expected == 5);
+			CHECK(that.compare_exchange("put", expected, 9));
+			CHECK(that.load("put") == 9);
+			
+			that.store("delete", 0);
+			CHECK(that.find("delete")->load() == 0);
+			CHECK(that.find("post") == nullptr);
+			CHECK_THROWS_AS(that.fetch_add("post", 1), std::out_of_range);
+		}
+	}
+	
+	GIVEN("threads incrementing the same keys")
+	{
+		gdc::atomic_nanomap<std::string, long, 8> that(std::begin(keys), std::end(keys));
+		std::vector<std::thread> threads;
+		
+		for (int t = 0; t < 4; ++t)
+		{
+			threads.emplace_back([&that, &keys, t]()
+			{
+				for (int i = 0; i < 10000; ++i)
+				{
+					that.fetch_add(keys[(i + t) % 3], 1, std::memory_order_relaxed);
+				}
+			});
+		}
+		
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		
+		THEN("no increment is lost")
+		{
+			long total = 0;
+			
+			for (auto it = that.get().cbegin(); it != that.get().cend(); ++it)
+			{
+				total += it.value().load();
+			}
+			
+			CHECK(total == 40000);
+		}
+	}
+	
+	GIVEN("more keys than fit")
+	{
+		const int many[] = { 1, 2, 3 };
+		
+		THEN("construction throws")
+		{
+			CHECK_THROWS_AS((gdc::atomic_nanomap<int, int, 2>(std::begin(many), std::end(many))), std::overflow_error);
+		}
+	}
+}
+
+
+SCENARIO("nanomap_table", "[concurrent]")
+{
+	GIVEN("a nanomap_table shared by several threads")
+	{
+		typedef gdc::nanomap_table<int, int, 8> table_type;
+		table_type that(100, 16);
+		std::vector<std::thread> threads;
+		
+		for (int t = 0; t < 4; ++t)
+		{
+			threads.emplace_back([&that]()
+			{
+				for (int i = 0; i < 20000; ++i)
+				{
+					that.with_map(static_cast<std::size_t>(i % 100), [i](table_type::map_type& map)
+					{
+						++map[i % 8];
+					});
+				}
+			});
+		}
+		
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		
+		THEN("no update is lost")
+		{
+			CHECK(that.size() == 100);
+			CHECK(that.stripes() == 16);
+			
+			int total = 0;
+			
+			for (std::size_t id = 0; id < that.size(); ++id)
+			{
+				total += that.with_map(id, [](table_type::map_type& map)
+				{
+					int sum = 0;
+					
+					for (auto it = map.cbegin(); it != map.cend(); ++it)
+					{
+						sum += it.value();
+					}
+					
+					return sum;
+				});
+			}
+			
+			CHECK(total == 80000);
+		}
+		
+		THEN("a lock is released when fn throws")
+		{
+			CHECK_THROWS_AS(that.with_map(3, [](table_type::map_type&) { throw std::runtime_error("failed"); }), std::runtime_error);
+			CHECK(that.with_map(3, [](table_type::map_type& map) { return map.size(); }) == 2);
+		}
+	}
+}
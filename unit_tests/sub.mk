@@ -1,6 +1,8 @@
 TARGET := tests/gdc-nanomap_unit_tests
+TGT_CXXFLAGS := -pthread
+TGT_LDFLAGS := -pthread
 TGT_INCDIRS := ../include
-SOURCES := unit_tests.cpp
+SOURCES := unit_tests.cpp concurrent_tests.cpp
 
 define COPY_HEADERS_AND_RUN_TESTS
 	$(TARGET_DIR)/$(TARGET)
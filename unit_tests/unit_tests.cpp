@@ -27,6 +27,12 @@
 
 #include <gdc/nanomap.hpp>
 
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 #include "catch.hpp"
 
 
@@ -109,6 +115,1656 @@ bool operator==(const int lhs, const myvalue& rhs)
 }
 
 
+enum class color : std::uint16_t
+{
+	red = 1, green = 2, blue = 3
+};
+
+
+// Fills a map to every possible size and looks up every key in it, as well
+// as a key that is not there. Exercises the vectorized scan at all offsets
+// within a vector and in the tail.
+template<typename key_type, std::uint16_t capacity, typename make_key>
+void check_find_all_sizes(make_key key_at)
+{
+	gdc::nanomap_factory<key_type, int, capacity> factory;
+	auto& that = factory.get();
+	
+	for (int n = 0; n <= capacity; ++n)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			auto it = that.find(key_at(i));
+			REQUIRE(it != that.end());
+			CHECK(it.value() == i);
+		}
+		
+		CHECK(that.find(key_at(capacity)) == that.end());
+		
+		if (n < capacity)
+		{
+			that.emplace(key_at(n), n);
+		}
+	}
+}
+
+
+#if defined(GDC_NANOMAP_SIMD)
+
+
+// Runs the kernels over keys 1, 2, 3, ... at every size and compares the
+// results with the plain loop.
+template<std::size_t width>
+void check_find_kernel(gdc::detail::isa level)
+{
+	typedef typename gdc::detail::word<width>::type word_type;
+	constexpr std::size_t capacity = 130;
+	word_type keys[capacity];
+	word_type needles[capacity + 2];
+	std::uint32_t out[capacity + 2];
+	gdc::detail::kernels kernels = gdc::detail::select_kernels<width>(level);
+	
+	for (std::size_t i = 0; i < capacity; ++i)
+	{
+		keys[i] = word_type(i + 1);
+	}
+	
+	for (std::size_t size = 0; size <= capacity; ++size)
+	{
+		for (std::size_t k = 0; k <= size + 1; ++k)
+		{
+			needles[k] = word_type(k);
+			CHECK(kernels.find(keys, size, capacity, &needles[k]) == gdc::detail::plain_find<width>(keys, size, capacity, &needles[k]));
+		}
+		
+		kernels.find_many(keys, size, capacity, needles, size + 2, out);
+		
+		for (std::size_t k = 0; k <= size + 1; ++k)
+		{
+			CHECK(out[k] == gdc::detail::plain_find<width>(keys, size, capacity, &needles[k]));
+		}
+	}
+}
+
+
+#endif
+
+
+SCENARIO("nanomap key scan", "[nanomap]")
+{
+#if defined(GDC_NANOMAP_SIMD)
+	GIVEN("every instruction set supported by the CPU")
+	{
+		using gdc::detail::isa;
+		const isa best = gdc::detail::detect_isa();
+		
+		THEN("each find kernel agrees with the plain loop")
+		{
+			for (isa level : { isa::none, isa::sse2, isa::avx2, isa::avx512 })
+			{
+				if (level > best)
+				{
+					break;
+				}
+				
+				check_find_kernel<1>(level);
+				check_find_kernel<2>(level);
+				check_find_kernel<4>(level);
+				check_find_kernel<8>(level);
+			}
+		}
+	}
+	
+#endif
+	
+	GIVEN("keys of every supported width")
+	{
+		THEN("find() locates every key and misses absent keys")
+		{
+			check_find_all_sizes<std::uint8_t, 67>([](int i) { return std::uint8_t(i * 3 + 1); });
+			check_find_all_sizes<std::int16_t, 67>([](int i) { return std::int16_t(-i * 257); });
+			check_find_all_sizes<int, 67>([](int i) { return i * 65537 + 1; });
+			check_find_all_sizes<std::uint64_t, 67>([](int i) { return (std::uint64_t(i) << 32) | 7u; });
+			check_find_all_sizes<color, 3>([](int i) { return color(i + 1); });
+		}
+	}
+	
+	GIVEN("pointer keys")
+	{
+		static int objects[33];
+		
+		THEN("find() compares addresses")
+		{
+			check_find_all_sizes<const int*, 32>([](int i) { return &objects[i]; });
+		}
+	}
+	
+	GIVEN("64-bit keys whose halves match the needle separately")
+	{
+		gdc::nanomap_factory<std::uint64_t, int, 4> factory;
+		auto& that = factory.get();
+		that[0x0000000100000002ull] = 1;
+		that[0x0000000200000001ull] = 2;
+		
+		THEN("find() does not report a partial match")
+		{
+			CHECK(that.find(0x0000000100000001ull) == that.end());
+			CHECK(that.find(0x0000000200000002ull) == that.end());
+			CHECK(that.find(0x0000000200000001ull).value() == 2);
+		}
+	}
+}
+
+
+SCENARIO("nanomap batch lookup", "[nanomap]")
+{
+	GIVEN("a nanomap with 40 keys and a batch of needles")
+	{
+		gdc::nanomap_factory<int, int, 48> factory;
+		auto& that = factory.get();
+		std::vector<int> needles;
+		
+		for (int i = 0; i < 40; ++i)
+		{
+			that[i * 3] = i;
+		}
+		
+		for (int i = 0; i < 1000; ++i)
+		{
+			needles.push_back(i % 150);
+		}
+		
+		WHEN("invoking find_many()")
+		{
+			std::vector<std::uint16_t> indices(needles.size());
+			std::size_t found = that.find_many(needles.data(), needles.data() + needles.size(), indices.data());
+			
+			THEN("each index matches find()")
+			{
+				for (std::size_t j = 0; j < needles.size(); ++j)
+				{
+					auto it = that.find(needles[j]);
+					CHECK(indices[j] == (it == that.end() ? that.max_size() : it.value()));
+				}
+			}
+			
+			THEN("the number of keys found is returned")
+			{
+				CHECK(found == std::count_if(needles.begin(), needles.end(), [](int k) { return k % 3 == 0 && k < 120; }));
+			}
+		}
+		
+		WHEN("invoking count_many()")
+		{
+			std::vector<int> counts(that.size());
+			that.count_many(needles.data(), needles.data() + needles.size(), counts.data());
+			
+			THEN("each key is counted as many times as it occurs")
+			{
+				for (auto it = that.begin(); it != that.end(); ++it)
+				{
+					CHECK(counts[it.value()] == std::count(needles.begin(), needles.end(), it.key()));
+				}
+			}
+		}
+	}
+	
+	GIVEN("a nanomap with keys that are not scanned with SIMD")
+	{
+		gdc::nanomap_factory<std::string, int, 4> factory;
+		auto& that = factory.get();
+		that["a"] = 1;
+		that["b"] = 2;
+		std::string needles[] = { "b", "c", "a", "b" };
+		std::uint16_t indices[4];
+		int counts[2] = { 0, 0 };
+		
+		THEN("find_many() and count_many() work the same")
+		{
+			CHECK(that.find_many(needles, needles + 4, indices) == 3);
+			CHECK(indices[0] == 1);
+			CHECK(indices[1] == that.max_size());
+			CHECK(indices[2] == 0);
+			CHECK(indices[3] == 1);
+			CHECK(that.count_many(needles, needles + 4, counts) == 3);
+			CHECK(counts[0] == 1);
+			CHECK(counts[1] == 2);
+		}
+	}
+}
+
+
+SCENARIO("nanomap with filtered search", "[nanomap]")
+{
+	typedef gdc::nanomap_factory<int, int, 32, std::equal_to<int>, gdc::filtered_search<int>> factory_type;
+	
+	GIVEN("a nanomap with keys 100, 200, ..., 1000")
+	{
+		factory_type factory;
+		auto& that = factory.get();
+		
+		for (int i = 1; i <= 10; ++i)
+		{
+			that[i * 100] = i;
+		}
+		
+		THEN("find() finds every key")
+		{
+			for (int i = 1; i <= 10; ++i)
+			{
+				CHECK(that.find(i * 100).value() == i);
+			}
+		}
+		
+		THEN("find() misses keys inside and outside the key range")
+		{
+			for (int k = -1000; k < 2000; ++k)
+			{
+				if (k % 100 != 0 || k < 100 || k > 1000)
+				{
+					CHECK(that.find(k) == that.end());
+				}
+			}
+		}
+		
+		WHEN("erasing a key")
+		{
+			that.erase(that.find(1000));
+			
+			THEN("the erased key is no longer found")
+			{
+				CHECK(that.find(1000) == that.end());
+			}
+			
+			THEN("the remaining keys are found")
+			{
+				for (int i = 1; i < 10; ++i)
+				{
+					CHECK(that.find(i * 100).value() == i);
+				}
+			}
+		}
+		
+		WHEN("clearing the map")
+		{
+			that.clear();
+			
+			THEN("no key is found")
+			{
+				CHECK(that.find(100) == that.end());
+			}
+			
+			THEN("new keys are found")
+			{
+				that[-5] = 5;
+				CHECK(that.find(-5).value() == 5);
+			}
+		}
+		
+		WHEN("taking a copy of the factory")
+		{
+			factory_type copy(factory);
+			
+			THEN("the copy finds every key")
+			{
+				for (int i = 1; i <= 10; ++i)
+				{
+					CHECK(copy.get().find(i * 100).value() == i);
+				}
+			}
+		}
+	}
+	
+	GIVEN("a nanomap with string keys")
+	{
+		gdc::nanomap_factory<std::string, int, 8, std::equal_to<std::string>, gdc::filtered_search<std::string>> factory;
+		auto& that = factory.get();
+		that["alpha"] = 1;
+		that["beta"] = 2;
+		
+		THEN("the filter works without a key range")
+		{
+			CHECK(that.find("alpha").value() == 1);
+			CHECK(that.find("beta").value() == 2);
+			CHECK(that.find("gamma") == that.end());
+		}
+	}
+}
+
+
+// A hash that gives every key the same tag.
+struct constant_hash
+{
+	std::size_t operator()(const std::string&) const
+	{
+		return 42;
+	}
+};
+
+
+template<typename search>
+void check_fingerprint_search()
+{
+	typedef gdc::nanomap_factory<std::string, int, 40, std::equal_to<std::string>, search> factory_type;
+	factory_type factory;
+	auto& that = factory.get();
+	
+	for (int i = 0; i < 40; ++i)
+	{
+		that["key" + std::to_string(i)] = i;
+	}
+	
+	for (int i = 0; i < 40; ++i)
+	{
+		CHECK(that.find("key" + std::to_string(i)).value() == i);
+		CHECK(that.find("other" + std::to_string(i)) == that.end());
+	}
+	
+	for (int i = 0; i < 40; i += 2)
+	{
+		that.erase(that.find("key" + std::to_string(i)));
+	}
+	
+	for (int i = 0; i < 40; ++i)
+	{
+		CHECK((that.find("key" + std::to_string(i)) == that.end()) == (i % 2 == 0));
+	}
+	
+	factory_type copy(factory);
+	
+	for (int i = 1; i < 40; i += 2)
+	{
+		CHECK(copy.get().find("key" + std::to_string(i)).value() == i);
+	}
+}
+
+
+SCENARIO("nanomap with tagged search", "[nanomap]")
+{
+	GIVEN("string keys with distinct tags")
+	{
+		THEN("keys are found, erased and copied")
+		{
+			check_fingerprint_search<gdc::tagged_search<std::string>>();
+		}
+	}
+	
+	GIVEN("string keys that all have the same tag")
+	{
+		THEN("key_equal resolves the tag collisions")
+		{
+			check_fingerprint_search<gdc::tagged_search<std::string, std::equal_to<std::string>, constant_hash>>();
+		}
+	}
+	
+	GIVEN("a nanomap initialized with init()")
+	{
+		typedef gdc::nanomap<int, int, std::equal_to<int>, gdc::tagged_search<int>> map_type;
+		int keys[3] = { 10, 20, 30 };
+		int values[3] = { 1, 2, 3 };
+		std::uint8_t tags[3];
+		map_type that;
+		that.init(keys, values, tags, 3, 3);
+		
+		THEN("the tags are computed for the existing keys")
+		{
+			CHECK(that.find(10).value() == 1);
+			CHECK(that.find(30).value() == 3);
+			CHECK(that.find(40) == that.end());
+		}
+	}
+}
+
+
+SCENARIO("nanomap with hashed search", "[nanomap]")
+{
+	typedef gdc::hashed_search<std::string> search_type;
+	
+	GIVEN("string keys")
+	{
+		THEN("keys are found, erased and copied")
+		{
+			check_fingerprint_search<search_type>();
+		}
+	}
+	
+	GIVEN("string keys that all have the same hash")
+	{
+		THEN("key_equal resolves the hash collisions")
+		{
+			check_fingerprint_search<gdc::hashed_search<std::string, std::equal_to<std::string>, constant_hash>>();
+		}
+	}
+	
+	GIVEN("a precomputed hash")
+	{
+		gdc::nanomap_factory<std::string, int, 8, std::equal_to<std::string>, search_type> factory;
+		auto& that = factory.get();
+		that["alpha"] = 1;
+		that["beta"] = 2;
+		std::hash<std::string> hash;
+		
+		THEN("find() with the hash finds the key")
+		{
+			CHECK(that.find("alpha", hash("alpha")).value() == 1);
+			CHECK(that.find("beta", hash("beta")).value() == 2);
+			CHECK(that.find("gamma", hash("gamma")) == that.end());
+		}
+		
+		THEN("find() with a wrong hash does not find the key")
+		{
+			CHECK(that.find("alpha", hash("beta")) == that.end());
+		}
+	}
+}
+
+
+template<typename map_type>
+void check_against(map_type& that, const std::vector<int>& expected)
+{
+	REQUIRE(that.size() == std::count_if(expected.begin(), expected.end(), [](int v) { return v >= 0; }));
+	
+	for (std::size_t k = 0; k < expected.size(); ++k)
+	{
+		auto it = that.find(static_cast<int>(k));
+		
+		if (expected[k] < 0)
+		{
+			REQUIRE(it == that.end());
+		}
+		else
+		{
+			REQUIRE(it != that.end());
+			REQUIRE(it.value() == expected[k]);
+		}
+	}
+}
+
+
+SCENARIO("nanomap with indexed search", "[nanomap]")
+{
+	GIVEN("a map that grows past the threshold and shrinks back")
+	{
+		gdc::nanomap_factory<int, int, 2000, std::equal_to<int>, gdc::indexed_search<int, std::equal_to<int>, std::hash<int>, 16>> factory;
+		auto& that = factory.get();
+		std::vector<int> expected(3000, -1);
+		
+		THEN("lookups agree with a reference at every size")
+		{
+			for (int i = 0; i < 2000; ++i)
+			{
+				const int k = (i * 1237) % 3000;
+				that[k] = i;
+				expected[k] = i;
+				
+				if (i % 97 == 0 || i < 40)
+				{
+					check_against(that, expected);
+				}
+			}
+			
+			check_against(that, expected);
+			
+			for (int i = 0; i < 1995; ++i)
+			{
+				const int k = (i * 1237 * 7) % 3000;
+				auto it = that.find(k);
+				
+				if (it != that.end())
+				{
+					that.erase(it);
+					expected[k] = -1;
+				}
+				
+				if (i % 101 == 0 || that.size() < 40)
+				{
+					check_against(that, expected);
+				}
+			}
+			
+			check_against(that, expected);
+		}
+		
+		THEN("batch lookups agree with single lookups")
+		{
+			for (int i = 0; i < 100; ++i)
+			{
+				that[i * 3] = i;
+			}
+			
+			std::vector<int> keys(300);
+			std::vector<std::uint16_t> indices(keys.size());
+			
+			for (int k = 0; k < 300; ++k)
+			{
+				keys[k] = k;
+			}
+			
+			that.find_many(keys.data(), keys.data() + keys.size(), indices.data());
+			
+			for (int k = 0; k < 300; ++k)
+			{
+				CHECK(indices[k] == (k % 3 == 0 ? that.find(k).value() : that.max_size()));
+			}
+		}
+		
+		THEN("clear() and init() keep the index consistent")
+		{
+			for (int i = 0; i < 500; ++i)
+			{
+				that[i] = i;
+			}
+			
+			that.clear();
+			CHECK(that.find(7) == that.end());
+			that[7] = 8;
+			CHECK(that.at(7) == 8);
+		}
+	}
+}
+
+
+SCENARIO("nanomap size types", "[nanomap]")
+{
+	GIVEN("a nanomap with an 8-bit size type")
+	{
+		gdc::nanomap_factory<int, int, 255, std::equal_to<int>, gdc::linear_search<int>, std::uint8_t> factory;
+		auto& that = factory.get();
+		
+		THEN("it holds 255 items")
+		{
+			static_assert(sizeof(that.size()) == 1, "size() returns std::uint8_t");
+			
+			for (int i = 0; i < 255; ++i)
+			{
+				that[i] = -i;
+			}
+			
+			CHECK(that.size() == 255);
+			CHECK(that.at(254) == -254);
+			CHECK(that.end() == that.find(255));
+			CHECK_THROWS_AS(that[255], std::overflow_error);
+		}
+	}
+	
+	GIVEN("a nanomap with a 32-bit size type")
+	{
+		typedef gdc::nanomap_factory<int, int, 70000, std::equal_to<int>, gdc::indexed_search<int>, std::uint32_t> factory_type;
+		std::unique_ptr<factory_type> factory(new factory_type);
+		auto& that = factory->get();
+		
+		THEN("it holds more than 65535 items")
+		{
+			for (int i = 0; i < 70000; ++i)
+			{
+				that[i * 2] = i;
+			}
+			
+			CHECK(that.size() == 70000);
+			
+			for (int i = 0; i < 70000; i += 7)
+			{
+				REQUIRE(that.at(i * 2) == i);
+				REQUIRE(that.find(i * 2 + 1) == that.end());
+			}
+			
+			that.erase(that.find(0));
+			CHECK(that.size() == 69999);
+			CHECK(that.find(0) == that.end());
+		}
+	}
+	
+	GIVEN("nanomaps with a stateless search policy")
+	{
+		THEN("the size type does not change their size")
+		{
+			CHECK(sizeof(gdc::nanomap<int, int, std::equal_to<int>, gdc::linear_search<int>, std::uint8_t>) == 2 * sizeof(void*) + 8);
+			CHECK(sizeof(gdc::nanomap<int, int, std::equal_to<int>, gdc::linear_search<int>, std::uint16_t>) == 2 * sizeof(void*) + 8);
+			CHECK(sizeof(gdc::nanomap<int, int, std::equal_to<int>, gdc::linear_search<int>, std::uint32_t>) == 2 * sizeof(void*) + 8);
+		}
+	}
+}
+
+
+// Throws when copied while fail is set, and when constructed from a
+// negative number.
+class fragile
+{
+public:
+	
+	static bool fail;
+	
+	
+	explicit fragile(int value) : _value(value)
+	{
+		if (value < 0)
+		{
+			throw std::invalid_argument("negative");
+		}
+	}
+	
+	
+	fragile(const fragile& f) : _value(f._value)
+	{
+		if (fail)
+		{
+			throw std::runtime_error("copy failed");
+		}
+	}
+	
+	
+	fragile(fragile&& f) noexcept : _value(f._value)
+	{
+	}
+	
+	
+	fragile& operator=(fragile&& f) noexcept
+	{
+		_value = f._value;
+		return *this;
+	}
+	
+	
+	int value() const
+	{
+		return _value;
+	}
+	
+	
+	bool operator==(const fragile& f) const
+	{
+		return _value == f._value;
+	}
+	
+	
+	bool operator<(const fragile& f) const
+	{
+		return _value < f._value;
+	}
+	
+	
+private:
+	
+	int _value;
+	
+};
+
+
+bool fragile::fail = false;
+
+
+SCENARIO("nanomap with sorted search", "[nanomap]")
+{
+	typedef gdc::nanomap_factory<int, myvalue, 512, std::equal_to<int>, gdc::sorted_search<int>> factory_type;
+	
+	GIVEN("a nanomap with 500 keys inserted in random order")
+	{
+		factory_type factory;
+		auto& that = factory.get();
+		std::vector<int> keys;
+		
+		for (int i = 0; i < 500; ++i)
+		{
+			keys.push_back(i * 7);
+		}
+		
+		std::srand(1234);
+		std::random_shuffle(keys.begin(), keys.end(), [](int n) { return std::rand() % n; });
+		
+		for (std::size_t i = 0; i < keys.size(); ++i)
+		{
+			if (i % 3 == 0)
+			{
+				that[keys[i]] = keys[i] + 1;
+			}
+			else if (i % 3 == 1)
+			{
+				that.insert(std::make_pair(keys[i], myvalue(keys[i] + 1)));
+			}
+			else
+			{
+				that.emplace(keys[i], keys[i] + 1);
+			}
+		}
+		
+		THEN("iteration visits the keys in ascending order")
+		{
+			int previous = -1;
+			
+			for (auto it = that.begin(); it != that.end(); ++it)
+			{
+				CHECK(it.key() > previous);
+				CHECK(it.value() == it.key() + 1);
+				previous = it.key();
+			}
+		}
+		
+		THEN("find() finds every key and misses the others")
+		{
+			for (int k = -1; k < 3600; ++k)
+			{
+				auto it = that.find(k);
+				
+				if (k >= 0 && k % 7 == 0 && k < 3500)
+				{
+					REQUIRE(it != that.end());
+					CHECK(it.value() == k + 1);
+				}
+				else
+				{
+					CHECK(it == that.end());
+				}
+			}
+		}
+		
+		WHEN("erasing every other key")
+		{
+			for (int k = 0; k < 3500; k += 14)
+			{
+				that.erase(that.find(k));
+			}
+			
+			THEN("the remaining keys are in order and found")
+			{
+				int previous = -1;
+				
+				for (auto it = that.begin(); it != that.end(); ++it)
+				{
+					CHECK(it.key() > previous);
+					CHECK(it.key() % 14 == 7);
+					CHECK(that.find(it.key()) == it);
+					previous = it.key();
+				}
+				
+				CHECK(that.size() == 250);
+			}
+		}
+		
+		WHEN("erasing the first item")
+		{
+			auto it = that.erase(that.begin());
+			
+			THEN("the returned iterator points to the next key")
+			{
+				CHECK(it.key() == 7);
+			}
+		}
+	}
+	
+	GIVEN("a sorted nanomap whose keys and values may throw")
+	{
+		gdc::nanomap_factory<fragile, fragile, 8, std::equal_to<fragile>, gdc::sorted_search<fragile>> factory;
+		auto& that = factory.get();
+		
+		for (int i = 1; i < 6; i += 2)
+		{
+			that.emplace(fragile(i), i * 10);
+		}
+		
+		THEN("a failed insert in the middle leaves the map unchanged")
+		{
+			fragile::fail = true;
+			CHECK_THROWS_AS(that.emplace(fragile(2), 20), std::runtime_error);
+			fragile::fail = false;
+			CHECK_THROWS_AS(that.emplace(fragile(4), -40), std::invalid_argument);
+			
+			std::vector<int> keys;
+			
+			for (auto it = that.cbegin(); it != that.cend(); ++it)
+			{
+				keys.push_back(it.key().value());
+				CHECK(it.value().value() == it.key().value() * 10);
+			}
+			
+			CHECK(keys == std::vector<int>({ 1, 3, 5 }));
+			CHECK(that.find(fragile(5)).value().value() == 50);
+			CHECK(that.emplace(fragile(2), 20).second);
+			CHECK(that.size() == 4);
+		}
+	}
+}
+
+
+template<typename search>
+void check_self_organizing_search(int expected_index)
+{
+	typedef gdc::nanomap_factory<int, int, 64, std::equal_to<int>, search> factory_type;
+	typedef typename factory_type::map_type::iterator iterator;
+	factory_type factory;
+	auto& that = factory.get();
+	
+	for (int i = 0; i < 40; ++i)
+	{
+		that[i] = i * 10;
+	}
+	
+	auto it = that.find(35);
+	CHECK(it.key() == 35);
+	CHECK(it.value() == 350);
+	CHECK(it == iterator(&that, expected_index));
+	
+	for (int n = 0; n < 1000; ++n)
+	{
+		that.find(n % 41);
+	}
+	
+	for (int i = 0; i < 40; ++i)
+	{
+		CHECK(that.find(i).value() == i * 10);
+	}
+	
+	CHECK(that.size() == 40);
+}
+
+
+SCENARIO("nanomap with self-organizing search", "[nanomap]")
+{
+	GIVEN("a nanomap with transpose_search")
+	{
+		THEN("a found key moves one SIMD block toward the front")
+		{
+			check_self_organizing_search<gdc::transpose_search<int>>(35 - 64 / sizeof(int));
+		}
+		
+		THEN("keys that are looked up repeatedly push the others out of the first SIMD block")
+		{
+			typedef gdc::nanomap_factory<int, int, 64, std::equal_to<int>, gdc::transpose_search<int>> factory_type;
+			factory_type factory;
+			auto& that = factory.get();
+			const int block = 64 / sizeof(int);
+			
+			for (int i = 0; i < 60; ++i)
+			{
+				that[i] = i;
+			}
+			
+			// block hot keys, all inserted after the cold ones.
+			for (int n = 0; n < 20; ++n)
+			{
+				for (int k = 60 - block; k < 60; ++k)
+				{
+					that.find(k);
+				}
+			}
+			
+			for (int k = 60 - block; k < 60; ++k)
+			{
+				auto it = that.cbegin();
+				int index = 0;
+				
+				while (it.key() != k)
+				{
+					++it;
+					++index;
+				}
+				
+				CHECK(index < block);
+				CHECK(it.value() == k);
+			}
+		}
+		
+		THEN("a string key moves one slot toward the front")
+		{
+			gdc::nanomap_factory<std::string, int, 4, std::equal_to<std::string>, gdc::transpose_search<std::string>> factory;
+			auto& that = factory.get();
+			that["a"] = 1;
+			that["b"] = 2;
+			that["c"] = 3;
+			that.find("c");
+			CHECK((++that.begin()).key() == "c");
+			that.find("c");
+			CHECK(that.begin().key() == "c");
+			CHECK(that.begin().value() == 3);
+		}
+	}
+	
+	GIVEN("a nanomap with move_to_front_search")
+	{
+		THEN("a found key moves to the front")
+		{
+			check_self_organizing_search<gdc::move_to_front_search<int>>(0);
+		}
+		
+		THEN("a found string key moves to the front")
+		{
+			gdc::nanomap_factory<std::string, int, 4, std::equal_to<std::string>, gdc::move_to_front_search<std::string>> factory;
+			auto& that = factory.get();
+			that["a"] = 1;
+			that["b"] = 2;
+			that["c"] = 3;
+			that.find("c");
+			CHECK(that.begin().key() == "c");
+			CHECK(that.begin().value() == 3);
+			that.find("b");
+			CHECK(that.begin().key() == "b");
+		}
+	}
+}
+
+
+struct point
+{
+	int x;
+	int y;
+};
+
+
+struct point_equal
+{
+	bool operator()(const point& lhs, const point& rhs) const
+	{
+		return lhs.x == rhs.x && lhs.y == rhs.y;
+	}
+};
+
+
+SCENARIO("nanomap with sentinel search", "[nanomap]")
+{
+	typedef gdc::nanomap_factory<point, int, 16, point_equal, gdc::sentinel_search<point, point_equal>> factory_type;
+	
+	GIVEN("a full nanomap")
+	{
+		factory_type factory;
+		auto& that = factory.get();
+		
+		for (int i = 0; i < 16; ++i)
+		{
+			that[point{ i, -i }] = i;
+		}
+		
+		THEN("find() finds every key")
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				CHECK(that.find(point{ i, -i }).value() == i);
+			}
+		}
+		
+		THEN("find() misses the other keys")
+		{
+			CHECK(that.find(point{ 16, -16 }) == that.end());
+			CHECK(that.find(point{ 1, 1 }) == that.end());
+		}
+		
+		WHEN("erasing a key")
+		{
+			that.erase(that.find(point{ 3, -3 }));
+			
+			THEN("the erased key is no longer found")
+			{
+				CHECK(that.find(point{ 3, -3 }) == that.end());
+				CHECK(that.find(point{ 15, -15 }).value() == 15);
+			}
+		}
+	}
+	
+	GIVEN("an empty nanomap")
+	{
+		factory_type factory;
+		auto& that = factory.get();
+		
+		THEN("find() returns end()")
+		{
+			CHECK(that.find(point{ 0, 0 }) == that.end());
+		}
+	}
+}
+
+
+template<typename key_type, std::uint16_t capacity, typename make_key>
+void check_static_find_all_sizes(make_key key_at)
+{
+	gdc::static_nanomap<key_type, int, capacity> that;
+	
+	for (int n = 0; n <= capacity; ++n)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			auto it = that.find(key_at(i));
+			REQUIRE(it != that.end());
+			CHECK(it.value() == i);
+		}
+		
+		CHECK(that.find(key_at(capacity)) == that.end());
+		
+		if (n < capacity)
+		{
+			that.emplace(key_at(n), n);
+		}
+	}
+}
+
+
+SCENARIO("static_nanomap", "[nanomap]")
+{
+	GIVEN("static_nanomaps of various key types and capacities")
+	{
+		THEN("find() locates every key and misses absent keys")
+		{
+			check_static_find_all_sizes<std::uint8_t, 5>([](int i) { return std::uint8_t(i + 1); });
+			check_static_find_all_sizes<int, 8>([](int i) { return i * 3; });
+			check_static_find_all_sizes<int, 16>([](int i) { return i * 3; });
+			check_static_find_all_sizes<int, 19>([](int i) { return i * 3; });
+			check_static_find_all_sizes<std::uint64_t, 20>([](int i) { return std::uint64_t(i) << 40; });
+			check_static_find_all_sizes<std::string, 6>([](int i) { return std::to_string(i); });
+			check_static_find_all_sizes<int, 100>([](int i) { return i * 3; });
+		}
+	}
+	
+	GIVEN("a large static_nanomap holding few keys")
+	{
+		gdc::static_nanomap<int, int, 1024> that;
+		
+		for (int i = 0; i < 40; ++i)
+		{
+			that[i] = i;
+		}
+		
+		for (int i = 39; i > 0; --i)
+		{
+			that.erase(that.find(i));
+		}
+		
+		THEN("keys erased from the slots past size are not found")
+		{
+			CHECK(that.size() == 1);
+			CHECK(that.find(0).value() == 0);
+			
+			for (int i = 1; i < 40; ++i)
+			{
+				CHECK(that.find(i) == that.end());
+			}
+		}
+	}
+	
+	GIVEN("a static_nanomap with 2 items")
+	{
+		typedef gdc::static_nanomap<int, myvalue, 16> map_type;
+		map_type that;
+		that[1] = 2;
+		that[3] = 4;
+		
+		THEN("it has the nanomap interface")
+		{
+			map_type::map_type& map = that;
+			CHECK(map.size() == 2);
+			CHECK(map.max_size() == 16);
+			CHECK(that.capacity() == 16);
+			CHECK(map.at(3) == 4);
+		}
+		
+		WHEN("taking a copy")
+		{
+			map_type copy(that);
+			
+			THEN("both have the items")
+			{
+				CHECK(that.size() == 2);
+				CHECK(copy.size() == 2);
+				CHECK(copy[1] == 2);
+				CHECK(copy[3] == 4);
+			}
+		}
+		
+		WHEN("moving it")
+		{
+			map_type moved(std::move(that));
+			
+			THEN("the items are moved")
+			{
+				CHECK(that.empty());
+				CHECK(moved.size() == 2);
+				CHECK(moved[1] == 2);
+				CHECK(moved[3] == 4);
+			}
+		}
+		
+		WHEN("assigning it")
+		{
+			map_type other;
+			other[5] = 6;
+			other = that;
+			
+			THEN("the items are replaced")
+			{
+				CHECK(other.size() == 2);
+				CHECK(other.find(5) == other.end());
+				CHECK(other[3] == 4);
+			}
+		}
+	}
+}
+
+
+enum class opcode
+{
+	nop, load, store, jump
+};
+
+
+constexpr gdc::frozen_nanomap<opcode, int, 3> opcode_lengths({ { opcode::load, 3 }, { opcode::store, 3 }, { opcode::jump, 2 } });
+
+
+static_assert(opcode_lengths.size() == 3, "size() is constexpr");
+static_assert(opcode_lengths.at(opcode::jump) == 2, "at() is constexpr");
+static_assert(opcode_lengths.find(opcode::store) == 1, "find() is constexpr");
+static_assert(!opcode_lengths.contains(opcode::nop), "contains() is constexpr");
+
+
+template<std::size_t ... I>
+constexpr gdc::frozen_nanomap<int, int, sizeof...(I)> squares(gdc::detail::index_sequence<I ...>)
+{
+	return gdc::frozen_nanomap<int, int, sizeof...(I)>({ { int(I), int(I * I) } ... });
+}
+
+
+// Deeper than the compiler's constexpr recursion limit, were lookups linear.
+constexpr gdc::frozen_nanomap<int, int, 600> square_table = squares(gdc::detail::make_index_sequence<600>::type());
+
+
+static_assert(square_table.at(599) == 358801, "large tables work at compile time");
+static_assert(!square_table.contains(600), "large tables work at compile time");
+
+
+SCENARIO("frozen_nanomap", "[nanomap]")
+{
+	GIVEN("a constexpr frozen_nanomap")
+	{
+		THEN("lookups work at run time")
+		{
+			opcode op = opcode::store;
+			CHECK(opcode_lengths.at(op) == 3);
+			CHECK(opcode_lengths.scan(op) == 1);
+			CHECK(opcode_lengths.scan(opcode::nop) == opcode_lengths.size());
+			CHECK_THROWS_AS(opcode_lengths.at(opcode::nop), std::out_of_range);
+		}
+	}
+	
+	GIVEN("a frozen_nanomap with 40 keys")
+	{
+		typedef gdc::frozen_nanomap<int, int, 40>::value_type item;
+		item items[40];
+		
+		for (int i = 0; i < 40; ++i)
+		{
+			items[i] = item(i * 5, i);
+		}
+		
+		gdc::frozen_nanomap<int, int, 40> that(items);
+		
+		THEN("find() and scan() agree")
+		{
+			for (int k = -1; k < 205; ++k)
+			{
+				CHECK(that.find(k) == that.scan(k));
+				CHECK(that.contains(k) == (k >= 0 && k < 200 && k % 5 == 0));
+			}
+		}
+		
+		THEN("keys and values are accessible by index")
+		{
+			CHECK(that.key(7) == 35);
+			CHECK(that.value(7) == 7);
+		}
+		
+		THEN("duplicate keys are rejected")
+		{
+			items[39].first = 0;
+			CHECK_THROWS_AS((gdc::frozen_nanomap<int, int, 40>(items)), std::invalid_argument);
+		}
+	}
+}
+
+
+SCENARIO("perfect_nanomap", "[nanomap]")
+{
+	GIVEN("a nanomap with 1000 keys")
+	{
+		gdc::nanomap_factory<int, int, 1000> factory;
+		auto& map = factory.get();
+		
+		for (int i = 0; i < 1000; ++i)
+		{
+			map[i * 7 - 300] = i;
+		}
+		
+		auto that = gdc::freeze(map);
+		
+		THEN("every key is found at its index in the map")
+		{
+			for (int i = 0; i < 1000; ++i)
+			{
+				auto it = that.find(i * 7 - 300);
+				REQUIRE(it != that.end());
+				CHECK(it == map.find(i * 7 - 300));
+				CHECK(it.value() == i);
+			}
+		}
+		
+		THEN("missing keys are not found")
+		{
+			for (int k = -400; k < 7000; ++k)
+			{
+				if ((k + 300) % 7 != 0 || k >= 6700)
+				{
+					CHECK(that.find(k) == that.end());
+				}
+			}
+			
+			CHECK_THROWS_AS(that.at(-301), std::out_of_range);
+		}
+		
+		THEN("values can be updated through the index")
+		{
+			that.at(1) = -1;
+			CHECK(map[1] == -1);
+		}
+	}
+	
+	GIVEN("nanomaps with string keys")
+	{
+		gdc::nanomap_factory<std::string, int, 100> factory;
+		auto& map = factory.get();
+		
+		THEN("an empty map can be frozen")
+		{
+			auto that = gdc::freeze(map);
+			CHECK(that.size() == 0);
+			CHECK(that.find("a") == that.end());
+		}
+		
+		for (int i = 0; i < 100; ++i)
+		{
+			map[std::to_string(i)] = i;
+		}
+		
+		THEN("keys are found with a precomputed hash")
+		{
+			auto that = gdc::freeze(map);
+			
+			for (int i = 0; i < 100; ++i)
+			{
+				const std::string key = std::to_string(i);
+				CHECK(that.find(key, std::hash<std::string>()(key)).value() == i);
+			}
+		}
+		
+		THEN("keys with equal hashes are rejected")
+		{
+			CHECK_THROWS_AS(gdc::freeze<constant_hash>(map), std::invalid_argument);
+		}
+	}
+}
+
+
+// Counts the instances alive, and has no default constructor.
+class counted
+{
+public:
+	
+	static int alive;
+	
+	
+	explicit counted(int value) : _value(value)
+	{
+		++alive;
+	}
+	
+	
+	counted(const counted& c) : _value(c._value)
+	{
+		++alive;
+	}
+	
+	
+	~counted()
+	{
+		--alive;
+	}
+	
+	
+	int value() const
+	{
+		return _value;
+	}
+	
+	
+private:
+	
+	int _value;
+	
+	
+};
+
+
+int counted::alive = 0;
+
+
+namespace gdc
+{
+	// std::unique_ptr only holds a pointer and can be moved with memcpy().
+	template<>
+	struct is_trivially_relocatable<std::unique_ptr<int>> : std::true_type
+	{
+	};
+}
+
+
+SCENARIO("nanomap storage", "[nanomap]")
+{
+	GIVEN("a nanomap_factory of values without a default constructor")
+	{
+		typedef gdc::nanomap_factory<std::string, counted, 256> factory_type;
+		std::unique_ptr<factory_type> factory(new factory_type);
+		
+		THEN("only inserted items are constructed and destroyed")
+		{
+			CHECK(counted::alive == 0);
+			
+			for (int i = 0; i < 3; ++i)
+			{
+				factory->get().emplace(std::to_string(i), i);
+			}
+			
+			CHECK(counted::alive == 3);
+			
+			{
+				factory_type copy(*factory);
+				CHECK(counted::alive == 6);
+				CHECK(copy.get().at("2").value() == 2);
+				
+				factory_type moved(std::move(copy));
+				CHECK(counted::alive == 6);
+				CHECK(copy.get().empty());
+				CHECK(moved.get().at("1").value() == 1);
+			}
+			
+			CHECK(counted::alive == 3);
+			factory->get().erase(factory->get().find("0"));
+			CHECK(counted::alive == 2);
+			factory.reset();
+			CHECK(counted::alive == 0);
+		}
+	}
+	
+	GIVEN("half-empty factories of trivially copyable items")
+	{
+		typedef gdc::nanomap_factory<int, double, 512, std::equal_to<int>, gdc::tagged_search<int>> tagged_type;
+		typedef gdc::nanomap_factory<int, double, 512, std::equal_to<int>, gdc::sorted_search<int>> sorted_type;
+		tagged_type tagged;
+		sorted_type sorted;
+		
+		for (int i = 0; i < 10; ++i)
+		{
+			tagged.get()[i * 7] = i / 2.0;
+			sorted.get()[100 - i] = i / 2.0;
+		}
+		
+		THEN("copies and moves hold the same items")
+		{
+			tagged_type tagged_copy(tagged);
+			sorted_type sorted_moved(std::move(sorted));
+			CHECK(tagged_copy.get().size() == 10);
+			CHECK(tagged_copy.get().at(63) == 4.5);
+			CHECK(tagged_copy.get().find(64) == tagged_copy.get().end());
+			CHECK(sorted.get().empty());
+			CHECK(sorted_moved.get().size() == 10);
+			CHECK(sorted_moved.get().cbegin().key() == 91);
+			CHECK(sorted_moved.get().at(100) == 0.0);
+		}
+		
+		THEN("static_nanomap copies and moves hold the same items")
+		{
+			gdc::static_nanomap<int, int, 16> that;
+			that[3] = 4;
+			that[5] = 6;
+			gdc::static_nanomap<int, int, 16> copy(that);
+			gdc::static_nanomap<int, int, 16> moved(std::move(that));
+			CHECK(copy.size() == 2);
+			CHECK(copy.at(5) == 6);
+			CHECK(moved.at(3) == 4);
+			CHECK(that.empty());
+			copy = moved;
+			CHECK(copy.size() == 2);
+		}
+	}
+	
+	GIVEN("a static_nanomap of values without a default constructor")
+	{
+		THEN("only inserted items are constructed and destroyed")
+		{
+			{
+				gdc::static_nanomap<int, counted, 8> that;
+				that.emplace(1, 10);
+				that.emplace(2, 20);
+				gdc::static_nanomap<int, counted, 8> copy(that);
+				CHECK(counted::alive == 4);
+				CHECK(copy.find(2).value().value() == 20);
+			}
+			
+			CHECK(counted::alive == 0);
+		}
+	}
+	
+	GIVEN("sorted maps that shift items on insert and erase")
+	{
+		typedef gdc::nanomap_factory<int, std::unique_ptr<int>, 64, std::equal_to<int>, gdc::sorted_search<int>> relocatable_type;
+		typedef gdc::nanomap_factory<int, counted, 64, std::equal_to<int>, gdc::sorted_search<int>> counted_type;
+		
+		THEN("trivially relocatable items keep their values")
+		{
+			relocatable_type factory;
+			
+			for (int i = 20; i > 0; --i)
+			{
+				factory.get().emplace(i, new int(i * 10));
+			}
+			
+			factory.get().erase(factory.get().find(1));
+			factory.get().erase(factory.get().find(10));
+			CHECK(factory.get().size() == 18);
+			CHECK(factory.get().cbegin().key() == 2);
+			
+			for (int i = 2; i <= 20; ++i)
+			{
+				if (i != 10)
+				{
+					CHECK(*factory.get().at(i) == i * 10);
+				}
+			}
+		}
+		
+		THEN("other items are moved one at a time")
+		{
+			{
+				counted_type factory;
+				
+				for (int i = 20; i > 0; --i)
+				{
+					factory.get().emplace(i, i * 10);
+				}
+				
+				CHECK(counted::alive == 20);
+				factory.get().erase(factory.get().find(5));
+				CHECK(counted::alive == 19);
+				CHECK(factory.get().at(6).value() == 60);
+				CHECK(factory.get().at(20).value() == 200);
+			}
+			
+			CHECK(counted::alive == 0);
+		}
+	}
+}
+
+
+SCENARIO("small_nanomap", "[nanomap]")
+{
+	GIVEN("a small_nanomap")
+	{
+		typedef gdc::small_nanomap<int, int, 8> map_type;
+		map_type that;
+		that[1] = 10;
+		that[2] = 20;
+		that[3] = 30;
+		
+		THEN("it holds its items inline")
+		{
+			CHECK(sizeof(map_type) <= 2 * 8 * sizeof(int) + alignof(int));
+			CHECK(sizeof(map_type::size_type) == 1);
+			CHECK(gdc::is_trivially_relocatable<map_type>::value);
+		}
+		
+		THEN("items can be looked up, inserted and erased")
+		{
+			CHECK(that.size() == 3);
+			CHECK(that.at(2) == 20);
+			CHECK(that.find(4) == that.end());
+			CHECK(that.count(3) == 1);
+			CHECK_FALSE(that.insert(std::make_pair(2, 0)).second);
+			CHECK(that.emplace(4, 40).first.value() == 40);
+			CHECK(that.erase(1) == 1);
+			CHECK(that.erase(1) == 0);
+			CHECK(that.size() == 3);
+			CHECK(that.at(4) == 40);
+			
+			int sum = 0;
+			
+			for (map_type::const_iterator it = that.cbegin(); it != that.cend(); ++it)
+			{
+				sum += it.key() + it.value();
+			}
+			
+			CHECK(sum == 99);
+		}
+		
+		THEN("it throws when full")
+		{
+			for (int i = 4; i < 9; ++i)
+			{
+				that[i] = i;
+			}
+			
+			CHECK_THROWS_AS(that[9], std::overflow_error);
+			CHECK_FALSE(that.emplace(9, 9).second);
+			const map_type& ref = that;
+			CHECK_THROWS_AS(ref.at(9), std::out_of_range);
+		}
+		
+		THEN("copies and moves are independent maps")
+		{
+			map_type copy(that);
+			copy[2] = 21;
+			map_type moved(std::move(that));
+			CHECK(copy.at(2) == 21);
+			CHECK(moved.at(2) == 20);
+			CHECK(that.empty());
+			that = copy;
+			CHECK(that.size() == 3);
+			CHECK(that.at(2) == 21);
+		}
+		
+		THEN("many maps can be stored in a std::vector")
+		{
+			std::vector<map_type> maps;
+			
+			for (int i = 0; i < 1000; ++i)
+			{
+				maps.push_back(that);
+				maps.back()[0] = i;
+			}
+			
+			CHECK(maps[0].at(0) == 0);
+			CHECK(maps[999].at(0) == 999);
+			CHECK(maps[500].at(3) == 30);
+		}
+	}
+	
+	GIVEN("a large small_nanomap holding few keys")
+	{
+		typedef gdc::small_nanomap<int, int, 1024> map_type;
+		std::unique_ptr<map_type> that(new map_type);
+		
+		for (int i = 0; i < 40; ++i)
+		{
+			(*that)[i] = i;
+		}
+		
+		for (int i = 39; i > 0; --i)
+		{
+			that->erase(i);
+		}
+		
+		THEN("lookups only see the keys in the map")
+		{
+			CHECK(sizeof(map_type::size_type) == 2);
+			CHECK(that->size() == 1);
+			CHECK(that->at(0) == 0);
+			
+			for (int i = 1; i < 40; ++i)
+			{
+				CHECK(that->find(i) == that->end());
+			}
+			
+			map_type copy(*that);
+			CHECK(copy.count(0) == 1);
+			CHECK(copy.count(39) == 0);
+		}
+	}
+	
+	GIVEN("trivially relocatable items that are not trivially copyable")
+	{
+		typedef gdc::small_nanomap<int, std::unique_ptr<int>, 4> inner_type;
+		typedef gdc::nanomap_factory<int, inner_type, 8, std::equal_to<int>, gdc::sorted_search<int>> outer_type;
+		
+		THEN("moves relocate the items and leave the source empty")
+		{
+			CHECK(gdc::is_trivially_relocatable<inner_type>::value);
+			inner_type inner;
+			inner.emplace(1, new int(10));
+			inner_type moved(std::move(inner));
+			CHECK(inner.empty());
+			CHECK(*moved.at(1) == 10);
+			
+			outer_type outer;
+			
+			for (int i = 4; i > 0; --i)
+			{
+				outer.get()[i].emplace(i, new int(i * 10));
+			}
+			
+			outer.get().erase(outer.get().find(2));
+			outer_type outer_moved(std::move(outer));
+			CHECK(outer.get().empty());
+			CHECK(outer_moved.get().size() == 3);
+			CHECK(*outer_moved.get().at(3).at(3) == 30);
+			CHECK(*outer_moved.get().at(4).at(4) == 40);
+		}
+	}
+	
+	GIVEN("small_nanomaps of strings and counted values")
+	{
+		typedef gdc::small_nanomap<std::string, counted, 4> map_type;
+		
+		THEN("only inserted items are constructed and destroyed")
+		{
+			{
+				std::vector<map_type> maps(1);
+				maps[0].emplace("a", 1);
+				maps[0].emplace("b", 2);
+				maps.resize(8);
+				maps[3] = maps[0];
+				maps[0].erase(maps[0].find("a"));
+				CHECK(counted::alive == 3);
+				CHECK(maps[0].at("b").value() == 2);
+				CHECK(maps[3].at("a").value() == 1);
+			}
+			
+			CHECK(counted::alive == 0);
+		}
+	}
+}
+
+
 SCENARIO("nanomap", "[nanomap]")
 {
 	typedef int key_type;